@@ -1,13 +1,76 @@
 
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
 #include "actor.h"
 #include "log.h"
 #include "ensure.h"
 #include "alloc_bitmap.h"
 #include "msg_macros.h"
+#include "entity.h"
+#include "video.h"
 
 static struct archetype *archetypes;
 static size_t n_archetypes;
 static alloc_bitmap actors;
+/* Archetypes hold the references to their atlases, so that spawning
+ * never has to load anything; actors just borrow them. */
+static struct texture **atlases;
+/* Each archetype's actors keep their state together in a pool of
+ * their own. */
+static alloc_bitmap *state_pools;
+
+/* Live actors are each on one list: the tick bucket for the frame
+ * they're next due, the timer list if they're asleep until a given
+ * time, or the dormant list if only actor_wake() can rouse them.
+ * Sleepers watching the viewport stay in the buckets, checked every
+ * ACTOR_MAX_TICK_PERIOD frames. */
+static struct actor_link buckets[ACTOR_MAX_TICK_PERIOD], timers, dormant;
+static unsigned frame;
+static double now;
+
+static inline void list_init(struct actor_link *l) { l->next = l->prev = l; }
+static inline bool list_is_empty(struct actor_link *l) { return l->next == l; }
+
+static inline void list_remove(struct actor_link *l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    list_init(l);
+}
+
+static inline void list_append(struct actor_link *list, struct actor_link *l)
+{
+    l->prev = list->prev;
+    l->next = list;
+    list->prev->next = l;
+    list->prev = l;
+}
+
+/* Moves everything on from onto the (empty) list to. */
+static inline void list_splice(struct actor_link *from, struct actor_link *to)
+{
+    list_init(to);
+    if (list_is_empty(from)) return;
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to->prev->next = to;
+    list_init(from);
+}
+
+#define ACTOR_OF_LINK(l) ((struct actor *)((uint8_t *)(l) - offsetof(struct actor, link)))
+
+static void schedule(struct actor *a, unsigned frames_from_now)
+{
+    list_remove(&a->link);
+    list_append(&buckets[(frame + frames_from_now) % ACTOR_MAX_TICK_PERIOD], &a->link);
+}
+
+static size_t rounded_state_size(struct archetype *arch)
+{
+    return (arch->state_size + sizeof (void *) - 1) & ~(sizeof (void *) - 1);
+}
 
 void actors_init(size_t n, struct archetype *as, size_t n_as)
 {
@@ -15,69 +78,307 @@ void actors_init(size_t n, struct archetype *as, size_t n_as)
     n_archetypes = n_as;
     ENSURE(n_archetypes > 0);
     ENSURE(actors = alloc_bitmap_init(n, sizeof (struct actor)));
+    ENSURE(atlases = calloc(n_archetypes, sizeof (*atlases)));
+    for (size_t i = 0; i < n_archetypes; ++i)
+        if (archetypes[i].atlas_path)
+            // XXX should use a placeholder if texture fails to load
+            ENSURE(atlases[i] = texture_cache_acquire(archetypes[i].atlas_path));
+    for (int i = 0; i < ACTOR_MAX_TICK_PERIOD; ++i)
+        list_init(&buckets[i]);
+    list_init(&timers);
+    list_init(&dormant);
+    frame = 0;
+    now = 0.;
+    ENSURE(state_pools = calloc(n_archetypes, sizeof (*state_pools)));
+    for (size_t i = 0; i < n_archetypes; ++i)
+        if (archetypes[i].state_size)
+            ENSURE(state_pools[i] = alloc_bitmap_init(n, rounded_state_size(&archetypes[i])));
 }
 
+static void destroy(struct actor *a);
+
 void actors_destroy(void)
 {
+    struct actor *a;
+    struct alloc_bitmap_iterator iter = alloc_bitmap_iterate(actors);
+    while ((a = iter.next(&iter)))
+        destroy(a);
     alloc_bitmap_destroy(actors);
     actors = NULL;
+    for (size_t i = 0; i < n_archetypes; ++i)
+        texture_cache_release(atlases[i]);
+    free(atlases);
+    atlases = NULL;
+    for (size_t i = 0; i < n_archetypes; ++i)
+        if (state_pools[i])
+            alloc_bitmap_destroy(state_pools[i]);
+    free(state_pools);
+    state_pools = NULL;
 }
 
+/* Drawing is the sprite system's job. */
 void actors_draw(void)
 {
-    struct actor *a;
-    struct alloc_bitmap_iterator iter = alloc_bitmap_iterate(actors);
-    while ((a = (struct actor *)iter.next(&iter)))
-        sprite_draw(&a->sprite, a->body->p);
+    sprites_draw();
 }
 
 static void destroy(struct actor *a)
 {
+    for (int i = 0; i < ACTOR_MAX_SUBSCRIPTIONS; ++i)
+        msg_unsubscribe(&a->subscriptions[i]);
+    components_clear(a->id);
     body_destroy(a->body);
-    texture_destroy(a->sprite.atlas);
-    free(a->sprite.atlas);
+    if (a->state)
+        ENSURE(alloc_bitmap_remove(state_pools[a->archetype], a->state));
+}
+
+static void reap(struct actor *a)
+{
+    list_remove(&a->link);
+    destroy(a);
+    alloc_bitmap_remove(actors, a);
+}
+
+static bool is_in_viewport(struct actor *a)
+{
+    float r = a->body->collision_radius, x = crealf(a->body->p), y = cimagf(a->body->p);
+    return x + r >= 0. && x - r <= viewport_w && y + r >= 0. && y - r <= viewport_h;
+}
+
+static void wake(struct actor *a, struct actor_link *onto)
+{
+    a->is_dormant = false;
+    list_remove(&a->link);
+    list_append(onto, &a->link);
+}
+
+/* Sleepers can be killed by messages long before they're next
+ * visited.  Those watching the viewport are visited every
+ * ACTOR_MAX_TICK_PERIOD frames anyway; the rest are on these lists. */
+static void reap_dead_sleepers(struct actor_link *list)
+{
+    for (struct actor_link *l = list->next, *next; l != list; l = next) {
+        next = l->next;
+        if (!ACTOR_OF_LINK(l)->base.handler)
+            reap(ACTOR_OF_LINK(l));
+    }
 }
 
+/* Only the actors due this frame are visited, plus any sleepers
+ * whose timers have run out, and the dead among the other sleepers. */
 void actors_update(float elapsed_time)
 {
-    struct actor *a;
-    struct alloc_bitmap_iterator iter = alloc_bitmap_iterate(actors);
-    struct tick_msg tick = {.super.type = MSG_TICK, .elapsed_time = elapsed_time};
-    while((a = iter.next(&iter))) {
-        TELL(a, &tick);
-        if (!a->base.handler) {
-            destroy(a);
-            iter.mark_for_removal(&iter);
+    now += elapsed_time;
+    ++frame;
+
+    struct actor_link batch;
+    list_splice(&buckets[frame % ACTOR_MAX_TICK_PERIOD], &batch);
+    while (!list_is_empty(&timers) && ACTOR_OF_LINK(timers.next)->wake_at <= now)
+        wake(ACTOR_OF_LINK(timers.next), &batch);
+
+    while (!list_is_empty(&batch)) {
+        struct actor *a = ACTOR_OF_LINK(batch.next);
+        if (a->base.handler && a->is_dormant) {
+            if ((a->wake_on & WAKE_ON_TIMER && a->wake_at <= now) || is_in_viewport(a))
+                a->is_dormant = false;
+            else {
+                schedule(a, ACTOR_MAX_TICK_PERIOD);
+                continue;
+            }
         }
+        if (a->base.handler && ear_hears(&a->base, MSG_TICK)) {
+            struct tick_msg tick = {.super.type = MSG_TICK, .elapsed_time = now - a->last_tick};
+            a->last_tick = now;
+            TELL(a, &tick);
+        }
+        if (!a->base.handler)
+            reap(a);
+        else if (&batch == a->link.prev)  /* it didn't go to sleep */
+            schedule(a, a->tick_period);
     }
-    iter.expunge_marked(&iter);
+
+    reap_dead_sleepers(&timers);
+    reap_dead_sleepers(&dormant);
 }
 
-struct actor *actor_spawn(enum actor_archetype type, position p, void *state)
+void actors_snapshot_regions(snapshot_region_fn fn)
+{
+    alloc_bitmap_regions(actors, fn);
+    for (size_t i = 0; i < n_archetypes; ++i)
+        if (state_pools[i])
+            alloc_bitmap_regions(state_pools[i], fn);
+    fn(buckets, sizeof (buckets));
+    fn(&timers, sizeof (timers));
+    fn(&dormant, sizeof (dormant));
+    fn(&frame, sizeof (frame));
+    fn(&now, sizeof (now));
+}
+
+void actor_set_tick_period(struct actor *a, unsigned tick_period)
+{
+    ENSURE(tick_period >= 1 && tick_period <= ACTOR_MAX_TICK_PERIOD);
+    a->tick_period = tick_period;
+    if (!a->is_dormant)
+        schedule(a, tick_period);
+}
+
+void actor_sleep(struct actor *a, unsigned wake_on, float seconds)
+{
+    a->is_dormant = true;
+    a->wake_on = wake_on;
+    a->wake_at = now + seconds;
+    list_remove(&a->link);
+    if (wake_on & WAKE_ON_VIEWPORT)
+        list_append(&buckets[(frame + ACTOR_MAX_TICK_PERIOD) % ACTOR_MAX_TICK_PERIOD], &a->link);
+    else if (wake_on & WAKE_ON_TIMER) {
+        /* most sleepers wake after those already asleep */
+        struct actor_link *l = timers.prev;
+        while (l != &timers && ACTOR_OF_LINK(l)->wake_at > a->wake_at)
+            l = l->prev;
+        list_append(l->next, &a->link);
+    } else
+        list_append(&dormant, &a->link);
+}
+
+void actor_wake(struct actor *a)
+{
+    if (!a->is_dormant) return;
+    wake(a, &buckets[(frame + 1) % ACTOR_MAX_TICK_PERIOD]);
+}
+
+/* Fills in a freshly reserved actor; the caller sends it MSG_ENTER. */
+static void init_actor(struct actor *a, enum actor_archetype type, struct body *body,
+                       void *state, const void *initial_state)
 {
-    ENSURE(type < n_archetypes);
     struct archetype *arch = &archetypes[type];
-    struct actor *a = (struct actor *)alloc_bitmap_alloc_first_free(actors);
-    if (NULL == a) return NULL;
     *a = (struct actor){
         .base.handler = arch->initial_handler,
-        .state = state
+        .archetype = type,
+        .state = state,
+        .last_tick = now,
+        .tick_period = 1
     };
-    a->sprite = (struct sprite) { .x = 0, .y = 0, .scaling = 1.f, .rotation = 0. };
-    // XXX will go in a dedicated atlas cache somewhere instead
-    ENSURE(a->sprite.atlas = calloc(1, sizeof (struct texture)));
-    // XXX should use a placeholder if texture fails to load
-    ENSURE(texture_from_png(a->sprite.atlas, arch->atlas_path));
-    a->sprite.w = a->sprite.atlas->width;
-    a->sprite.h = a->sprite.atlas->height;
-    ENSURE(a->body = body_new(p, arch->collision_radius));
+    list_init(&a->link);
+    schedule(a, 1);
+    if (state) {
+        if (initial_state)
+            memcpy(state, initial_state, arch->state_size);
+        else
+            memset(state, 0, arch->state_size);
+    }
+    a->body = body;
+    a->id = body_entity(body);
+    struct sprite *s = actor_sprite(a);
+    *s = (struct sprite) { .x = 0, .y = 0, .scaling = 1.f, .rotation = 0. };
+    ENSURE(s->atlas = atlases[type]);
+    s->w = s->atlas->width;
+    s->h = s->atlas->height;
     a->body->mass = arch->mass;
     a->body->ear = &a->base;
-    struct msg enter = { .type = MSG_ENTER };
-    TELL(a, &enter);
+}
+
+static void enter(struct actor *a)
+{
+    struct archetype *arch = &archetypes[a->archetype];
+    if (arch->initial_state)
+        ear_enter_state(&a->base, arch->initial_state);
+    else {
+        struct msg enter = { .type = MSG_ENTER };
+        TELL(a, &enter);
+    }
+}
+
+struct actor *actor_spawn(enum actor_archetype type, position p, const void *initial_state)
+{
+    ENSURE(type < n_archetypes);
+    struct archetype *arch = &archetypes[type];
+    struct actor *a = (struct actor *)alloc_bitmap_alloc_first_free(actors);
+    if (NULL == a) return NULL;
+    void *state = NULL;
+    /* there are as many states as actors, so this can't fail */
+    if (arch->state_size)
+        ENSURE(state = alloc_bitmap_alloc_first_free(state_pools[type]));
+    struct body *body;
+    ENSURE(body = body_new(p, arch->collision_radius));
+    init_actor(a, type, body, state, initial_state);
+    enter(a);
     return a;
 }
 
+void formation_layout(struct formation f, size_t n, position origin, position *out)
+{
+    float s = f.spacing;
+    switch (f.shape) {
+    case FORMATION_LINE:
+        for (size_t i = 0; i < n; ++i)
+            out[i] = origin + s * (i - (n-1)/2.f);
+        break;
+    case FORMATION_V:
+        /* odd members to the left, even to the right */
+        for (size_t i = 0; i < n; ++i) {
+            float rank = (i+1)/2, side = (i&1) ? -1.f : 1.f;
+            out[i] = origin + s*rank * (side - I);
+        }
+        break;
+    case FORMATION_CIRCLE: {
+        float r = n > 1 ? s / (2.f * sinf(M_PI / n)) : 0.f;
+        for (size_t i = 0; i < n; ++i)
+            out[i] = origin + r * cexpf(I * (2.f * M_PI * i / n));
+        break;
+    }
+    case FORMATION_GRID: {
+        size_t cols = ceilf(sqrtf(n)), rows = cols ? (n + cols - 1) / cols : 0;
+        for (size_t i = 0; i < n; ++i)
+            out[i] = origin + s * ((i%cols - (cols-1)/2.f) + I*(i/cols - (rows-1)/2.f));
+        break;
+    }
+    default:
+        ENSURE(false);
+    }
+}
+
+bool actors_spawn_wave(enum actor_archetype type, struct formation f, size_t n,
+                       position origin, const void *shared_state, struct actor **out)
+{
+    ENSURE(type < n_archetypes);
+    ENSURE(n <= ACTOR_MAX_WAVE_SIZE);
+    if (0 == n) return true;
+    struct archetype *arch = &archetypes[type];
+    void *as[n], *states[n];
+    struct body *bodies[n];
+    position ps[n];
+
+    /* Reserve everything before touching any of it, so a wave that
+     * doesn't fit leaves no stragglers behind. */
+    if (!alloc_bitmap_alloc_n(actors, n, as)) return false;
+    formation_layout(f, n, origin, ps);
+    if (!bodies_new(n, ps, arch->collision_radius, bodies)) {
+        for (size_t i = 0; i < n; ++i)
+            alloc_bitmap_remove(actors, as[i]);
+        return false;
+    }
+    if (arch->state_size)
+        ENSURE(alloc_bitmap_alloc_n(state_pools[type], n, states));
+
+    for (size_t i = 0; i < n; ++i)
+        init_actor(as[i], type, bodies[i], arch->state_size ? states[i] : NULL, shared_state);
+    for (size_t i = 0; i < n; ++i) {
+        enter(as[i]);
+        if (out) out[i] = as[i];
+    }
+    return true;
+}
+
+void actor_subscribe(struct actor *a, msg_type type)
+{
+    for (int i = 0; i < ACTOR_MAX_SUBSCRIPTIONS; ++i)
+        if (NULL == a->subscriptions[i].ear) {
+            msg_subscribe(&a->subscriptions[i], &a->base, type);
+            return;
+        }
+    ENSURE(false);
+}
+
 #ifdef UNIT_TEST_ACTOR
 #include "libtap/tap.h"
 #include "video.h"
@@ -90,13 +391,35 @@ do_nothing_handler(struct ear *me __attribute__((unused)),
     return STATE_IGNORED;
 }
 
-enum { N_TEST_ARCHETYPES = 1 };
+struct test_state { int a, b; char c; };
+struct tick_count { int n; float elapsed; };
+
+static enum handler_return
+counting_handler(struct actor *me, struct msg *m) {
+    if (MSG_TICK != m->type) return STATE_IGNORED;
+    struct tick_count *c = me->state;
+    ++c->n;
+    c->elapsed += ((struct tick_msg *)m)->elapsed_time;
+    return STATE_HANDLED;
+}
+
+enum { N_TEST_ARCHETYPES = 3 };
 static struct archetype test_archetypes[N_TEST_ARCHETYPES] = {
     { .atlas_path = "t/common.tiny-1x1.png",
       .collision_radius = 20.,
       .mass = 30.,
       .initial_handler = (msg_handler)do_nothing_handler,
-      .state_size = 0 }
+      .state_size = 0 },
+    { .atlas_path = "t/common.tiny-1x1.png",
+      .collision_radius = 20.,
+      .mass = 30.,
+      .initial_handler = (msg_handler)do_nothing_handler,
+      .state_size = sizeof (struct test_state) },
+    { .atlas_path = "t/common.tiny-1x1.png",
+      .collision_radius = 1.,
+      .mass = 1.,
+      .initial_handler = (msg_handler)counting_handler,
+      .state_size = sizeof (struct tick_count) }
 };
 
 static void test_actors_basic_api()
@@ -104,6 +427,7 @@ static void test_actors_basic_api()
     note("Test basic API on actors for ordinary, successful cases");
     int n = 32;
     bodies_init(n);
+    components_init();
     actors_init(n, test_archetypes, N_TEST_ARCHETYPES);
     /* draw no one */
     actors_draw();
@@ -126,6 +450,188 @@ static void test_actors_basic_api()
     actors_update(1.);
 
     actors_destroy();
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_actor_subscriptions(void)
+{
+    note("Test that destroyed actors leave the message bus");
+    bodies_init(2);
+    components_init();
+    actors_init(2, test_archetypes, N_TEST_ARCHETYPES);
+    struct actor *a = actor_spawn(0, 0., NULL), *b = actor_spawn(0, 0., NULL);
+    actor_subscribe(a, MSG_LEVEL_END);
+    actor_subscribe(b, MSG_LEVEL_END);
+    actor_subscribe(b, MSG_USER);
+    cmp_ok(msg_subscriber_count(MSG_LEVEL_END), "==", 2);
+    b->base.handler = NULL;
+    actors_update(1.);
+    cmp_ok(msg_subscriber_count(MSG_LEVEL_END), "==", 1);
+    cmp_ok(msg_subscriber_count(MSG_USER), "==", 0);
+    actors_destroy();
+    cmp_ok(msg_subscriber_count(MSG_LEVEL_END), "==", 0);
+    msg_bus_destroy();
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_actor_state(void)
+{
+    note("Test that actors own copies of their state");
+    bodies_init(4);
+    components_init();
+    actors_init(4, test_archetypes, N_TEST_ARCHETYPES);
+    struct test_state init = { .a = 1, .b = 2, .c = 3 };
+    struct actor *a = actor_spawn(1, 0., &init), *b = actor_spawn(1, 0., NULL);
+    ok(NULL == actor_spawn(0, 0., &init)->state, "Stateless archetypes get no state");
+    struct test_state *sa = a->state, *sb = b->state;
+    ok(sa && sa != &init && 1 == sa->a && 2 == sa->b && 3 == sa->c,
+       "State is copied from the initializer");
+    ok(sb && sb != sa && 0 == sb->a && 0 == sb->c, "or zeroed");
+    sa->a = 42;
+    a->base.handler = NULL;
+    actors_update(1.);
+    a = actor_spawn(1, 0., NULL);
+    ok(a->state == sa && 0 == ((struct test_state *)a->state)->a,
+       "Destroyed actors' state is recycled, and cleared");
+    actors_destroy();
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_formations(void)
+{
+    note("Test formation layouts");
+    position ps[9];
+    formation_layout((struct formation){FORMATION_LINE, 10.}, 3, 5.*I, ps);
+    ok(ps[0] == -10.+5.*I && ps[1] == 5.*I && ps[2] == 10.+5.*I, "Lines are centred");
+    formation_layout((struct formation){FORMATION_V, 10.}, 3, 0., ps);
+    ok(ps[0] == 0. && ps[1] == -10.-10.*I && ps[2] == 10.-10.*I, "Vs trail their leader");
+    formation_layout((struct formation){FORMATION_CIRCLE, 10.}, 6, 0., ps);
+    ok(fabsf(cabsf(ps[1] - ps[0]) - 10.f) < 1e-3 && fabsf(cabsf(ps[3]) - 10.f) < 1e-3,
+       "Circles keep their spacing");
+    formation_layout((struct formation){FORMATION_GRID, 10.}, 9, 0., ps);
+    ok(ps[0] == -10.-10.*I && ps[4] == 0. && ps[8] == 10.+10.*I, "Grids are square");
+}
+
+static void test_actor_waves(void)
+{
+    note("Test spawning whole waves at once");
+    enum { N = 256, WAVE = 200 };
+    bodies_init(N);
+    components_init();
+    actors_init(N, test_archetypes, N_TEST_ARCHETYPES);
+    struct test_state shared = { .a = 7 };
+    struct actor *wave[WAVE];
+    ok(actors_spawn_wave(1, (struct formation){FORMATION_GRID, 20.}, WAVE, 0., &shared, wave));
+    bool all_copied = true;
+    for (int i = 0; i < WAVE; ++i)
+        all_copied &= wave[i]->state != &shared && 7 == ((struct test_state *)wave[i]->state)->a
+            && wave[i]->body->ear == &wave[i]->base;
+    ok(all_copied, "Every member gets its own copy of the shared state");
+    ok(!actors_spawn_wave(0, (struct formation){FORMATION_LINE, 20.}, N-WAVE+1, 0., NULL, NULL),
+       "Waves that don't fit aren't spawned");
+    ok(actors_spawn_wave(0, (struct formation){FORMATION_LINE, 20.}, N-WAVE, 0., NULL, NULL),
+       "and leave nothing behind");
+    ok(NULL == actor_spawn(0, 0., NULL));
+    actors_destroy();
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_tick_scheduling(void)
+{
+    note("Test tick periods and sleeping actors");
+    bodies_init(8);
+    components_init();
+    actors_init(8, test_archetypes, N_TEST_ARCHETYPES);
+    const float dt = .125;
+    void run(int n_frames) { for (int i = 0; i < n_frames; ++i) actors_update(dt); }
+    struct actor *a = actor_spawn(2, viewport_w/2. + I*viewport_h/2., NULL);
+    struct tick_count *c = a->state;
+
+    run(2);
+    ok(2 == c->n && .25 == c->elapsed, "Ticked every frame by default");
+    actor_set_tick_period(a, 4);
+    *c = (struct tick_count){0};
+    run(8);
+    ok(2 == c->n && 1. == c->elapsed, "Ticked every fourth frame, with all the elapsed time");
+
+    actor_set_tick_period(a, 1);
+    *c = (struct tick_count){0};
+    actor_sleep(a, WAKE_ON_TIMER, .5);
+    run(3);
+    ok(0 == c->n, "Not ticked while asleep");
+    run(1);
+    ok(1 == c->n && .5 == c->elapsed, "Woken by its timer, covering the time it slept");
+
+    *c = (struct tick_count){0};
+    actor_sleep(a, 0, 0.);
+    run(20);
+    ok(0 == c->n, "Only actor_wake() wakes some sleepers");
+    actor_wake(a);
+    run(1);
+    ok(1 == c->n && 2.625 == c->elapsed, "but it does");
+
+    *c = (struct tick_count){0};
+    a->body->p = -100.*I;
+    actor_sleep(a, WAKE_ON_VIEWPORT, 0.);
+    run(2*ACTOR_MAX_TICK_PERIOD);
+    ok(0 == c->n, "Not woken off screen");
+    a->body->p = viewport_w/2. + I*viewport_h/2.;
+    run(ACTOR_MAX_TICK_PERIOD);
+    ok(1 <= c->n, "Woken on screen");
+
+    actor_sleep(a, WAKE_ON_TIMER, 1000.);
+    a->base.handler = NULL;
+    actors_update(dt);
+    struct actor *b = actor_spawn(0, 0., NULL);
+    ok(a == b, "Dead sleepers are reaped without a draw, freeing their slot");
+    actor_sleep(b, 0, 0.);
+    b->base.handler = NULL;
+    actors_update(dt);
+    ok(a == actor_spawn(0, 0., NULL), "even those only actor_wake() would rouse");
+    actors_destroy();
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_actor_snapshots(void)
+{
+    note("Test snapshots of actors and their bodies");
+    bodies_init(32);
+    components_init();
+    actors_init(32, test_archetypes, N_TEST_ARCHETYPES);
+    struct test_state init = { .a = 1 };
+    struct actor *a = actor_spawn(1, 10., &init);
+    actor_subscribe(a, MSG_USER);
+    bodies_snapshot_regions(snapshot_track);
+    components_snapshot_regions(snapshot_track);
+    actors_snapshot_regions(snapshot_track);
+    snapshot_track_hook(&msg_bus_snapshot_hook);
+    snapshot s = snapshot_take(NULL);
+
+    ((struct test_state *)a->state)->a = 2;
+    a->body->p = 20.;
+    a->base.handler = NULL;
+    actors_update(1.);
+    for (int i = 0; i < 8; ++i)
+        ENSURE(actor_spawn(0, 0., NULL));
+    snapshot_restore(s);
+    ok(a->base.handler && 1 == ((struct test_state *)a->state)->a && 10. == a->body->p &&
+       actor_sprite(a)->atlas,
+       "Actors come back as they were");
+    cmp_ok(msg_subscriber_count(MSG_USER), "==", 1);
+    int n = 0;
+    while (actor_spawn(0, 0., NULL)) ++n;
+    cmp_ok(n, "==", 31, "and nobody spawned since is left over");
+
+    snapshot_destroy(s);
+    snapshot_untrack_all();
+    actors_destroy();
+    msg_bus_destroy();
+    components_destroy();
     bodies_destroy();
 }
 
@@ -134,11 +640,16 @@ int main(void)
     video_init();
     camera_init();
     sprite_init();
-    plan(33);
+    plan(63);
     test_actors_basic_api();
+    test_actor_subscriptions();
+    test_actor_state();
+    test_formations();
+    test_actor_waves();
+    test_tick_scheduling();
+    test_actor_snapshots();
     // TODO verify a placeholder sprite is used if texture fails to load
     // TODO verify a placeholder actor is used if archetype doesn't exist
-    // TODO construct an alternate archetypes table for testing
     done_testing();
 }
 #endif
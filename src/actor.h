@@ -3,25 +3,87 @@
 #include "msg.h"
 #include "sprite.h"
 #include "physics.h"
+#include "entity.h"
 #include "game_constants.h"
+#include "snapshot.h"
+
+enum { ACTOR_MAX_SUBSCRIPTIONS = 4, ACTOR_MAX_WAVE_SIZE = 256, ACTOR_MAX_TICK_PERIOD = 8 };
+
+/* What wakes a sleeping actor besides actor_wake(). */
+enum actor_wake_on {
+    WAKE_ON_TIMER = 1,
+    WAKE_ON_VIEWPORT = 2        /* its body touches the viewport */
+};
+
+struct actor_link { struct actor_link *next, *prev; };  /* private */
 
 struct actor {
     struct ear base;
-    struct sprite sprite;
-    struct body *body;
-    void *state;
+    entity id;
+    struct body *body;          /* its transform component */
+    enum actor_archetype archetype;
+    void *state;                /* state_size bytes, owned by the actor */
+    struct msg_subscription subscriptions[ACTOR_MAX_SUBSCRIPTIONS];
+    /* scheduling; private */
+    struct actor_link link;
+    double last_tick, wake_at;
+    uint8_t tick_period, wake_on;
+    bool is_dormant;
 };
 
 struct archetype {
     const char *atlas_path;
     float collision_radius, mass;
+    /* one or the other */
     msg_handler initial_handler;
+    struct msg_state *initial_state;
     size_t state_size;
 };
 
+enum formation_shape {
+    FORMATION_LINE,             /* abreast, centred on the origin */
+    FORMATION_V,                /* leader at the origin, ranks trailing upwards */
+    FORMATION_CIRCLE,           /* around the origin */
+    FORMATION_GRID              /* as square as possible, centred on the origin */
+};
+
+struct formation {
+    enum formation_shape shape;
+    float spacing;              /* between neighbouring members */
+};
+
+extern void formation_layout(struct formation f, size_t n, position origin, position *out);
+
+static inline struct sprite *actor_sprite(struct actor *a)
+{
+    return &sprite_components[a->id];
+}
+
 extern void actors_init(size_t n, struct archetype *archetypes, size_t n_archetypes);
 extern void actors_destroy(void);
 extern void actors_draw(void);
 extern void actors_update(float elapsed_time);
+/* Covers the actors, their state and their scheduling, but not their
+ * bodies. */
+extern void actors_snapshot_regions(snapshot_region_fn fn);
 
-extern struct actor *actor_spawn(enum actor_archetype type, position p, void *state);
+/* The actor's state is copied from initial_state, or zeroed if that
+ * is NULL. */
+extern struct actor *actor_spawn(enum actor_archetype type, position p, const void *initial_state);
+/* Spawns all n members of a wave, each with its own copy of
+ * shared_state, or none of them if there isn't room.  Members are
+ * written to out, if it isn't NULL. */
+extern bool actors_spawn_wave(enum actor_archetype type, struct formation f, size_t n,
+                              position origin, const void *shared_state, struct actor **out);
+/* Actors are ticked every tick_period frames (1 to
+ * ACTOR_MAX_TICK_PERIOD), and MSG_TICK carries all the time elapsed
+ * since their last tick. */
+extern void actor_set_tick_period(struct actor *a, unsigned tick_period);
+/* A sleeping actor isn't ticked until one of wake_on happens, or
+ * someone calls actor_wake() -- say, its own handler on receiving a
+ * message, which sleeping actors still do.  Its first tick after
+ * waking covers the whole time it slept. */
+extern void actor_sleep(struct actor *a, unsigned wake_on, float seconds);
+extern void actor_wake(struct actor *a);
+/* Subscriptions last until the actor is destroyed. */
+extern void actor_subscribe(struct actor *a, msg_type type);
@@ -81,6 +81,26 @@ void *alloc_bitmap_alloc_first_free(alloc_bitmap t_)
     return NULL;
 }
 
+bool alloc_bitmap_alloc_n(alloc_bitmap t_, size_t n, void **out)
+{
+    struct t *t = t_;
+    if (n > (t->count<<SHIFT) - t->actual) return false;
+    /* Take every free bit of a word before moving on, so the cost
+     * is one scan of the bitmap rather than one per member. */
+    size_t k = 0;
+    for (size_t word = 0; k < n; ++word) {
+        ENSURE(word < t->count);
+        limb free = ~t->bits[word];
+        for (; free && k < n; free &= free-1) {
+            size_t bit = __builtin_ctz(free);
+            t->bits[word] |= (limb)1<<bit;
+            out[k++] = address_of_member(t, word, bit);
+        }
+    }
+    t->actual += n;
+    return true;
+}
+
 static void remove_member(struct t *t, size_t word, size_t bit)
 {
     memset(address_of_member(t, word, bit),
@@ -101,6 +121,23 @@ bool alloc_bitmap_remove(alloc_bitmap t_, void *m)
     return present;
 }
 
+void *alloc_bitmap_members(alloc_bitmap t)
+{
+    return ((struct t *)t)->members;
+}
+
+size_t alloc_bitmap_capacity(alloc_bitmap t)
+{
+    return ((struct t *)t)->count << SHIFT;
+}
+
+void alloc_bitmap_regions(alloc_bitmap t_, snapshot_region_fn fn)
+{
+    struct t *t = t_;
+    fn(t, sizeof (*t));
+    fn(t->bits, t->count * sizeof (limb));
+    fn(t->members, (t->count << SHIFT) * t->member_size);
+}
 
 static void *it_next(struct alloc_bitmap_iterator *me)
 {
@@ -207,9 +244,32 @@ static void test_3270f2291199b735e46d6d00d1e905d1531e7f21(void)
     alloc_bitmap_destroy(bm);
 }
 
+static void test_alloc_n(void)
+{
+    note("Test bulk allocation");
+    enum { N = 64 };
+    alloc_bitmap bm = alloc_bitmap_init(N, sizeof (intptr_t));
+    void *ms[N];
+    intptr_t *a = alloc_bitmap_alloc_first_free(bm), *b = alloc_bitmap_alloc_first_free(bm);
+    *a = *b = -1;
+    ok(alloc_bitmap_alloc_n(bm, N-2, ms), "Fill the rest in one go");
+    bool distinct = true;
+    for (int i = 0; i < N-2; ++i) {
+        distinct &= ms[i] != a && ms[i] != b && 0 == *(intptr_t *)ms[i];
+        *(intptr_t *)ms[i] = i;
+    }
+    ok(distinct, "Bulk members are fresh");
+    ok(NULL == alloc_bitmap_alloc_first_free(bm), "Full after bulk allocation");
+    alloc_bitmap_remove(bm, ms[5]);
+    ok(!alloc_bitmap_alloc_n(bm, 2, ms), "All or nothing");
+    ok(alloc_bitmap_alloc_n(bm, 1, ms) && NULL == alloc_bitmap_alloc_first_free(bm),
+       "A failed bulk allocation takes nothing");
+    alloc_bitmap_destroy(bm);
+}
+
 int main(void)
 {
-    plan(9);
+    plan(14);
     lives_ok({test_create_iterate_remove(1000);}, "regular bitmap");
     // TODO: should improve the speed of these routines so a 1M bitmap can be tested
     lives_ok({test_create_iterate_remove(24*1024);}, "larger bitmap");
@@ -217,6 +277,7 @@ int main(void)
     lives_ok({test_tiny_bitmap();}, "tiny bitmap");
     lives_ok({test_overflow();}, "Test overflow");
     test_3270f2291199b735e46d6d00d1e905d1531e7f21();
+    test_alloc_n();
     done_testing();
 }
 #endif
@@ -3,12 +3,21 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "snapshot.h"
+
 typedef void *alloc_bitmap;
 
 extern alloc_bitmap alloc_bitmap_init(size_t count, size_t member_size);
 extern void alloc_bitmap_destroy(alloc_bitmap);
 extern void *alloc_bitmap_alloc_first_free(alloc_bitmap);
+/* Reserves n members into out, or none at all if there isn't room. */
+extern bool alloc_bitmap_alloc_n(alloc_bitmap, size_t n, void **out);
 extern bool alloc_bitmap_remove(alloc_bitmap, void *);
+/* Members sit in one array, by slot, whether they're in use or not. */
+extern void *alloc_bitmap_members(alloc_bitmap);
+extern size_t alloc_bitmap_capacity(alloc_bitmap);
+/* Everything a snapshot needs to capture the bitmap and its members. */
+extern void alloc_bitmap_regions(alloc_bitmap, snapshot_region_fn);
 
 struct alloc_bitmap_iterator {
     /* private */
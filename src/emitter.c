@@ -0,0 +1,191 @@
+
+#include <math.h>
+
+#include "emitter.h"
+#include "alloc_bitmap.h"
+#include "ensure.h"
+
+struct t {
+    struct emitter_params params;
+    struct body *anchor;
+    position offset;
+    float heading, cooldown;
+    uint8_t speed_curve;
+    /* each projectile's direction relative to the heading, worked out
+     * once so that a volley only needs the heading's sine and cosine */
+    float dx[EMITTER_MAX_COUNT], dy[EMITTER_MAX_COUNT];
+};
+
+static alloc_bitmap emitters;
+
+void emitters_init(size_t n)
+{
+    ENSURE(emitters = alloc_bitmap_init(n, sizeof (struct t)));
+}
+
+void emitters_destroy(void)
+{
+    alloc_bitmap_destroy(emitters);
+    emitters = NULL;
+}
+
+void emitters_snapshot_regions(snapshot_region_fn fn)
+{
+    alloc_bitmap_regions(emitters, fn);
+}
+
+emitter emitter_new(const struct emitter_params *params, struct body *anchor, position offset)
+{
+    ENSURE(params->count >= 1 && params->count <= EMITTER_MAX_COUNT);
+    ENSURE(params->interval > 0. && params->type < PROJECTILE_LAST);
+    ENSURE(EMITTER_AIMED != params->pattern || params->target);
+    struct t *e = alloc_bitmap_alloc_first_free(emitters);
+    if (NULL == e) return NULL;
+    *e = (struct t){
+        .params = *params,
+        .anchor = anchor,
+        .offset = offset,
+        .heading = params->heading,
+        .speed_curve = params->speed_curve.easing ?
+            projectile_speed_curve(params->speed_curve) : PROJECTILE_CONSTANT_SPEED
+    };
+
+    if (0.f == e->params.speed)
+        e->params.speed = projectile_archetypes[params->type].speed;
+
+    unsigned n = params->count;
+    for (unsigned i = 0; i < n; ++i) {
+        float theta;
+        switch (params->pattern) {
+        case EMITTER_RADIAL:
+        case EMITTER_SPIRAL:
+            theta = 2.f * M_PI * i / n;
+            break;
+        case EMITTER_AIMED:
+        case EMITTER_SPREAD:
+            theta = params->angular_step * (i - (n-1)/2.f);
+            break;
+        default:
+            ENSURE(false);
+        }
+        e->dx[i] = cosf(theta);
+        e->dy[i] = sinf(theta);
+    }
+    return e;
+}
+
+void emitter_destroy(emitter e)
+{
+    ENSURE(alloc_bitmap_remove(emitters, e));
+}
+
+static void volley(struct t *e)
+{
+    struct emitter_params *params = &e->params;
+    position origin = (e->anchor ? e->anchor->p : 0.f) + e->offset;
+    float heading = EMITTER_AIMED == params->pattern ?
+        cargf(params->target->p - origin) : e->heading;
+    float c = params->speed * cosf(heading), s = params->speed * sinf(heading);
+
+    unsigned n = params->count;
+    position vs[EMITTER_MAX_COUNT];
+    /* (dx + i dy)(c + i s), spelt out so it vectorizes */
+    for (unsigned i = 0; i < n; ++i)
+        vs[i] = (e->dx[i]*c - e->dy[i]*s) + I*(e->dx[i]*s + e->dy[i]*c);
+    projectiles_fire(origin, n, vs, e->speed_curve, params->type, params->affiliation);
+
+    if (EMITTER_SPIRAL == params->pattern)
+        e->heading += params->angular_step;
+}
+
+void emitters_update(float elapsed_time)
+{
+    struct t *e;
+    struct alloc_bitmap_iterator iter = alloc_bitmap_iterate(emitters);
+    while ((e = iter.next(&iter))) {
+        e->heading += e->params.rotation_speed * elapsed_time;
+        for (e->cooldown -= elapsed_time; e->cooldown <= 0.f; e->cooldown += e->params.interval)
+            volley(e);
+    }
+}
+
+#ifdef UNIT_TEST_EMITTER
+#include "libtap/tap.h"
+#include "video.h"
+#include "camera.h"
+#include "game_constants.h"
+
+static void test_volleys(void)
+{
+    note("Test that emitters fire whole volleys at their interval");
+    bodies_init(2);
+    projectiles_init(1024);
+    emitters_init(4);
+    struct emitter_params radial = {
+        .pattern = EMITTER_RADIAL, .affiliation = AFFILIATION_ENEMY,
+        .count = 8, .interval = .5, .speed = 100.
+    };
+    emitter e = emitter_new(&radial, NULL, 320. + 240.*I);
+    emitters_update(.1);
+    cmp_ok(projectiles_count(), "==", 8);
+    emitters_update(.5);
+    cmp_ok(projectiles_count(), "==", 16);
+    emitter_destroy(e);
+
+    struct emitter_params spiral = {
+        .pattern = EMITTER_SPIRAL, .affiliation = AFFILIATION_ENEMY,
+        .count = 2, .angular_step = .25, .interval = .1, .speed = 100.
+    };
+    struct t *s = emitter_new(&spiral, NULL, 320. + 240.*I);
+    emitters_update(.35);
+    ok(fabsf(s->heading - 1.f) < .001, "Spirals turn with each volley");
+
+    emitters_destroy();
+    projectiles_destroy();
+    bodies_destroy();
+}
+
+static void test_aimed(void)
+{
+    note("Test that aimed emitters follow their target");
+    bodies_init(4);
+    projectiles_init(1024);
+    emitters_init(4);
+    /* all on one side, so nothing is hit, and projectiles only go by
+     * leaving the screen */
+    struct body *target = body_new(10. + 240.*I, 10.), *boss = body_new(40. + 240.*I, 10.);
+    target->affiliation = boss->affiliation = AFFILIATION_ENEMY;
+    struct emitter_params aimed = {
+        .pattern = EMITTER_AIMED, .affiliation = AFFILIATION_ENEMY,
+        .count = 3, .angular_step = .5, .interval = 1., .speed = 400.,
+        .speed_curve = { .initial = .5, .duration = 1., .easing = easing_cubic },
+        .target = target
+    };
+    emitter_new(&aimed, boss, 0.);
+    void run(int n_frames) {
+        for (int i = 0; i < n_frames; ++i) {
+            emitters_update(1/60.);
+            projectiles_update(1/60.);
+        }
+    }
+    run(30);
+    cmp_ok(projectiles_count(), "==", 0, "A fan aimed off the near edge is soon gone");
+    target->p = 600. + 240.*I;
+    run(60);
+    cmp_ok(projectiles_count(), "==", 3, "and the next, aimed across the screen, isn't");
+
+    emitters_destroy();
+    projectiles_destroy();
+    bodies_destroy();
+}
+
+int main(void)
+{
+    video_init();
+    camera_init();
+    plan(5);
+    test_volleys();
+    test_aimed();
+    done_testing();
+}
+#endif
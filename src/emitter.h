@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include "geometry.h"
+#include "physics.h"
+#include "projectile.h"
+#include "snapshot.h"
+
+enum { EMITTER_MAX_COUNT = 64 };
+
+enum emitter_pattern {
+    EMITTER_RADIAL,             /* all round, turning at rotation_speed */
+    EMITTER_SPIRAL,             /* all round, turning angular_step more each volley */
+    EMITTER_AIMED,              /* a fan centred on the target */
+    EMITTER_SPREAD              /* a fan centred on the heading */
+};
+
+/* Everything about a pattern; angles in radians, clockwise from the
+ * positive x axis (screen y being down). */
+struct emitter_params {
+    enum emitter_pattern pattern;
+    enum projectile_type type;
+    unsigned affiliation;       /* or PROJECTILE_DEFAULT_AFFILIATION */
+    unsigned count;             /* per volley, up to EMITTER_MAX_COUNT */
+    float angular_step;         /* between a fan's projectiles */
+    float heading, rotation_speed;
+    float interval;             /* between volleys */
+    float speed;                /* or 0, for the type's */
+    struct speed_curve speed_curve; /* or zeroed, for constant speed */
+    struct body *target;        /* for EMITTER_AIMED */
+};
+
+typedef void *emitter;
+
+extern void emitters_init(size_t n);
+extern void emitters_destroy(void);
+/* Fires every emitter's volleys due this frame, straight into the
+ * projectiles; before projectiles_update, so they move this frame. */
+extern void emitters_update(float elapsed_time);
+extern void emitters_snapshot_regions(snapshot_region_fn fn);
+
+/* Emitters fire from their anchor's position plus offset; the anchor,
+ * if any, and target must outlive them.  NULL if there's no room. */
+extern emitter emitter_new(const struct emitter_params *params, struct body *anchor,
+                           position offset);
+extern void emitter_destroy(emitter e);
@@ -1,15 +1,11 @@
 #include "game.h"
 #include "actor.h"
+#include "enemy.h"
 #include "msg_macros.h"
 #include "projectile.h"
 #include "log.h"
 #include "sfx.h"
 
-struct enemy_a {
-    unsigned *group_ctr;
-    float frame_ctr;
-};
-
 static enum handler_return enemy_explode(struct actor *me, struct msg *e)
 {
     switch (e->type) {
@@ -22,11 +18,14 @@ static enum handler_return enemy_explode(struct actor *me, struct msg *e)
         return STATE_HANDLED;
     }
     case MSG_ENTER:
-        me->sprite.x = 24;
-        me->sprite.y = 0;
-        me->sprite.w = 26;
-        me->sprite.h = 24;
+        me->base.interests = MSG_INTEREST(MSG_TICK);
+        actor_sprite(me)->x = 24;
+        actor_sprite(me)->y = 0;
+        actor_sprite(me)->w = 26;
+        actor_sprite(me)->h = 24;
         ((struct enemy_a *)me->state)->frame_ctr = .5;
+        /* nothing to do until it's over */
+        actor_sleep(me, WAKE_ON_TIMER, .5);
         sfx_play_oneshot(SFX_SMALL_EXPLOSION);
         return STATE_HANDLED;
     }
@@ -34,45 +33,66 @@ static enum handler_return enemy_explode(struct actor *me, struct msg *e)
 
 #include <math.h>
 
+enum { ENEMY_HEALTH = 1 };
+
+/* Enemies spawned outside a group have no latch to count down. */
 static void die(struct enemy_a *state)
 {
-    if (*state->group_ctr > 0)
-        --*state->group_ctr;
-    else
+    if (state->group && !strand_latch_count_down(state->group))
         LOG_DEBUG("Enemy's group counter already zero");
 }
 
-static enum handler_return enemy_a_initial(struct actor *me, struct msg *e)
+/* Behaviour common to all our enemies; the states below it only
+ * need to say how they move. */
+static enum handler_return enemy_common(struct actor *me, struct msg *e)
 {
     switch (e->type) {
     default: break;
-    case MSG_TICK: {
-        float t = ((struct tick_msg *)e)->elapsed_time;
-        me->body->impulses = (100.*t*I) + 100.*t*sinf(cimagf(me->body->p)/100);
-        return STATE_HANDLED;
-    }
     case MSG_DAMAGE:
+        health_components[me->id] -= ((struct damage_msg *)e)->amount;
+        if (health_components[me->id] > 0)
+            return STATE_HANDLED;
         die(me->state);
         return XITION(enemy_explode);
     case MSG_OFFSIDE:
         die(me->state);
         return XITION(NULL);
+    case MSG_LEVEL_END:
+        return XITION(NULL);
     case MSG_COLLISION: {
         struct damage_msg dm = { .base.type = MSG_DAMAGE, .amount = 1 };
-        TELL(((struct collision_msg *)e)->them->ear, &dm);
+        POST(((struct collision_msg *)e)->them->ear, &dm);
         return STATE_HANDLED;
     }
     case MSG_ENTER:
+        actor_subscribe(me, MSG_LEVEL_END);
         me->body->affiliation = AFFILIATION_ENEMY;
-        me->sprite.x = 58;
-        me->sprite.y = 0;
-        me->sprite.w = 26;
-        me->sprite.h = 24;
+        health_components[me->id] = ENEMY_HEALTH;
+        actor_sprite(me)->x = 58;
+        actor_sprite(me)->y = 0;
+        actor_sprite(me)->w = 26;
+        actor_sprite(me)->h = 24;
         return STATE_HANDLED;
     }
     return STATE_IGNORED;
 }
 
+static enum handler_return enemy_a_initial(struct actor *me, struct msg *e)
+{
+    if (MSG_TICK != e->type) return STATE_IGNORED;
+    float t = ((struct tick_msg *)e)->elapsed_time;
+    me->body->impulses = (100.*t*I) + 100.*t*sinf(cimagf(me->body->p)/100);
+    return STATE_HANDLED;
+}
+
+static struct msg_state enemy_common_state = {
+    .handler = (msg_handler)enemy_common
+};
+static struct msg_state enemy_a_initial_state = {
+    .handler = (msg_handler)enemy_a_initial,
+    .parent = &enemy_common_state
+};
+
 __attribute__ ((constructor))
 static void populate_archetypes(void)
 {
@@ -80,14 +100,14 @@ static void populate_archetypes(void)
         .atlas_path = "data/sprites.png",
         .collision_radius = 20.,
         .mass = 30.,
-        .initial_handler = (msg_handler)enemy_a_initial,
+        .initial_state = &enemy_a_initial_state,
         .state_size = sizeof (struct enemy_a)
     };
     global_archetypes[ARCHETYPE_CIRCLING_ENEMY] = (struct archetype){
         .atlas_path = "data/sprites.png",
         .collision_radius = 20.,
         .mass = 30.,
-        .initial_handler = (msg_handler)enemy_a_initial,
+        .initial_state = &enemy_a_initial_state,
         .state_size = sizeof (struct enemy_a)
     };
 }
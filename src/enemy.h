@@ -0,0 +1,10 @@
+#pragma once
+
+#include "strand.h"
+
+/* State for the basic enemies; level scripts pass one in when
+ * spawning them. */
+struct enemy_a {
+    struct strand_latch *group;
+    float frame_ctr;
+};
@@ -0,0 +1,207 @@
+
+#include <math.h>
+#include <string.h>
+
+#include "entity.h"
+#include "camera.h"
+#include "video.h"
+#include "ensure.h"
+
+struct sprite *sprite_components;
+int32_t *health_components;
+static size_t capacity;
+
+/* sprites_draw's scratch: the visible entities, then their sprites
+ * and positions counting-sorted by atlas. */
+enum { MAX_ATLASES_PER_FRAME = 32 };
+static entity *visible;
+static uint8_t *batch_of_visible;
+static struct sprite **batch_sprites;
+static position *batch_ps;
+
+void components_init(void)
+{
+    capacity = bodies_capacity();
+    ENSURE(sprite_components = calloc(capacity, sizeof (*sprite_components)));
+    ENSURE(health_components = calloc(capacity, sizeof (*health_components)));
+    ENSURE(visible = calloc(capacity, sizeof (*visible)));
+    ENSURE(batch_of_visible = calloc(capacity, sizeof (*batch_of_visible)));
+    ENSURE(batch_sprites = calloc(capacity, sizeof (*batch_sprites)));
+    ENSURE(batch_ps = calloc(capacity, sizeof (*batch_ps)));
+}
+
+void components_destroy(void)
+{
+    free(sprite_components);
+    free(health_components);
+    free(visible);
+    free(batch_of_visible);
+    free(batch_sprites);
+    free(batch_ps);
+    sprite_components = NULL;
+    health_components = NULL;
+    visible = NULL;
+    batch_of_visible = NULL;
+    batch_sprites = NULL;
+    batch_ps = NULL;
+    capacity = 0;
+}
+
+void components_snapshot_regions(snapshot_region_fn fn)
+{
+    fn(sprite_components, capacity * sizeof (*sprite_components));
+    fn(health_components, capacity * sizeof (*health_components));
+}
+
+void components_clear(entity e)
+{
+    ENSURE(e < capacity);
+    memset(&sprite_components[e], 0, sizeof (*sprite_components));
+    health_components[e] = 0;
+}
+
+/* Sprites turn about their top left corner, then are scaled about
+ * the origin along with their position (see sprite_batch.vert); a
+ * circle about that corner out to its diagonal, scaled likewise,
+ * holds any of them. */
+static inline bool is_on_screen(struct sprite *s, position p)
+{
+    position corner = s->scaling * (p + world_camera.translation - (s->w + I*s->h) / 2.f);
+    float r = fabsf(s->scaling) * hypotf(s->w, s->h);
+    float x = crealf(corner), y = cimagf(corner);
+    return x + r >= 0. && x - r <= viewport_w && y + r >= 0. && y - r <= viewport_h;
+}
+
+size_t sprites_draw(void)
+{
+    struct body *bodies = bodies_slots();
+    struct texture *atlases[MAX_ATLASES_PER_FRAME];
+    size_t batch_ends[MAX_ATLASES_PER_FRAME+1] = {0};
+    unsigned n_batches = 0, last = 0;
+    size_t n_visible = 0;
+
+    for (entity e = 0; e < capacity; ++e) {
+        struct sprite *s = &sprite_components[e];
+        if (NULL == s->atlas || !is_on_screen(s, bodies[e].p)) continue;
+        /* there are only ever a handful of atlases, mostly in runs */
+        if (0 == n_batches || atlases[last] != s->atlas) {
+            for (last = 0; last < n_batches && atlases[last] != s->atlas; ++last);
+            if (last == n_batches) {
+                ENSURE(n_batches < MAX_ATLASES_PER_FRAME);
+                atlases[n_batches++] = s->atlas;
+            }
+        }
+        visible[n_visible] = e;
+        batch_of_visible[n_visible++] = last;
+        ++batch_ends[last+1];
+    }
+
+    for (unsigned i = 1; i <= n_batches; ++i)
+        batch_ends[i] += batch_ends[i-1];
+    /* batch_ends[b] starts as the start of batch b, and ends up as its
+     * end; stable, so each batch keeps the usual drawing order. */
+    for (size_t i = 0; i < n_visible; ++i) {
+        size_t j = batch_ends[batch_of_visible[i]]++;
+        batch_sprites[j] = &sprite_components[visible[i]];
+        batch_ps[j] = bodies[visible[i]].p;
+    }
+    /* sorted, so the batch flushes once per atlas */
+    sprite_draw_batch(batch_sprites, batch_ps, n_visible);
+    return n_visible;
+}
+
+#ifdef UNIT_TEST_ENTITY
+#include "libtap/tap.h"
+
+static void test_components(void)
+{
+    note("Test that components line up with bodies");
+    bodies_init(64);
+    components_init();
+    struct body *a = body_new(1., 1.), *b = body_new(2., 1.);
+    entity ea = body_entity(a), eb = body_entity(b);
+    ok(ea != eb && &bodies_slots()[ea] == a && &bodies_slots()[eb] == b);
+    health_components[eb] = 3;
+    sprite_components[eb].scaling = 1.;
+    body_destroy(b);
+    components_clear(eb);
+    b = body_new(3., 1.);
+    ok(body_entity(b) == eb && 0 == health_components[eb] && 0. == sprite_components[eb].scaling,
+       "Recycled entities start without components");
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_sprites_draw(void)
+{
+    note("Test drawing many entities");
+    enum { N = 10000 };
+    bodies_init(N);
+    components_init();
+    struct texture t[2];
+    ok(texture_from_png(&t[0], "t/sprite.t-0.png") && texture_from_png(&t[1], "t/sprite.t-0.png"));
+    for (int i = 0; i < N; ++i) {
+        /* the second half well off screen */
+        float x = i < N/2 ? i % viewport_w : viewport_w + 100. + i % 100;
+        entity e = body_entity(body_new(x + I*(i % viewport_h), 1.));
+        sprite_components[e] = (struct sprite){
+            .atlas = &t[i%2], .x = 16*(i%2), .w = 16, .h = 16, .scaling = 1.
+        };
+    }
+    video_start_frame();
+    cmp_ok(sprites_draw(), "==", N/2, "Off-screen sprites are culled");
+    video_end_frame();
+
+    size_t n_runs = 1;
+    bool is_in_order = true;
+    for (size_t i = 1; i < N/2; ++i) {
+        if (batch_sprites[i]->atlas != batch_sprites[i-1]->atlas)
+            ++n_runs;
+        else
+            is_in_order &= batch_sprites[i] > batch_sprites[i-1];
+    }
+    ok(2 == n_runs && is_in_order, "Drawn in one run per atlas, each in entity order");
+
+    texture_destroy(&t[0]);
+    texture_destroy(&t[1]);
+    components_destroy();
+    bodies_destroy();
+}
+
+static void test_culling_transforms(void)
+{
+    note("Test that culling allows for scaling and rotation");
+    bodies_init(8);
+    components_init();
+    struct texture t;
+    ENSURE(texture_from_png(&t, "t/sprite.t-0.png"));
+    struct sprite base = { .atlas = &t, .w = 16, .h = 16, .scaling = 1. };
+    entity grown = body_entity(body_new(400. + 240.*I, 1.)),
+        shrunk = body_entity(body_new(700. + 100.*I, 1.)),
+        turned = body_entity(body_new(viewport_w + 20. + 100.*I, 1.));
+    sprite_components[grown] = sprite_components[shrunk] = sprite_components[turned] = base;
+    sprite_components[grown].scaling = 2.;      /* scaled right off the edge */
+    sprite_components[shrunk].scaling = .5;     /* and onto the screen */
+    sprite_components[turned].rotation = M_PI;  /* swung back over the edge */
+    video_start_frame();
+    cmp_ok(sprites_draw(), "==", 2);
+    video_end_frame();
+    ok(&sprite_components[shrunk] == batch_sprites[0] && &sprite_components[turned] == batch_sprites[1],
+       "Culls where sprites end up, not where their bodies are");
+    texture_destroy(&t);
+    components_destroy();
+    bodies_destroy();
+}
+
+int main(void)
+{
+    video_init();
+    camera_init();
+    sprite_init();
+    plan(7);
+    test_components();
+    test_sprites_draw();
+    test_culling_transforms();
+    done_testing();
+}
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "physics.h"
+#include "sprite.h"
+#include "snapshot.h"
+
+/* An entity is the slot of its body in the body pool.  The body is
+ * its transform; its other components sit at the same index in dense
+ * arrays of their own, so systems sweep them side by side instead of
+ * chasing pointers.  A zeroed component is an absent one. */
+typedef uint32_t entity;
+
+/* After bodies_init, before bodies_destroy. */
+extern void components_init(void);
+extern void components_destroy(void);
+extern void components_snapshot_regions(snapshot_region_fn fn);
+
+/* Indexed by entity. */
+extern struct sprite *sprite_components;
+extern int32_t *health_components;
+
+static inline entity body_entity(struct body *b)
+{
+    return b - bodies_slots();
+}
+
+/* Whoever destroys an entity's body clears its components. */
+extern void components_clear(entity e);
+
+/* Draws every entity with a sprite that's on screen, one batch per
+ * atlas; returns how many it drew. */
+extern size_t sprites_draw(void);
@@ -1,10 +1,13 @@
 
 #include <math.h>
+#include <string.h>
 
 #include "actor.h"
 #include "audio.h"
 #include "camera.h"
+#include "emitter.h"
 #include "ensure.h"
+#include "entity.h"
 #include "game.h"
 #include "game_constants.h"
 #include "input.h"
@@ -18,6 +21,7 @@
 #include "physics.h"
 #include "projectile.h"
 #include "sfx.h"
+#include "snapshot.h"
 #include "stage.h"
 #include "strand.h"
 #include "text.h"
@@ -32,7 +36,9 @@ struct game {
 
 enum outcome { NO_OUTCOME = 0, OUTCOME_QUIT, OUTCOME_OUT_OF_LIVES, OUTCOME_NEXT_LEVEL };
 
-enum { MAX_N_BODIES = 128, MAX_N_ACTORS = 64, MAX_N_PROJECTILES = 64 };
+enum { MAX_N_BODIES = 512, MAX_N_ACTORS = 256, MAX_N_PROJECTILES = 20000,
+       MAX_N_EMITTERS = 32,
+       MSG_QUEUE_BYTES = 16*1024 };
 
 static struct archetype _archetypes[ARCHETYPE_LAST];
 struct archetype *global_archetypes = _archetypes;
@@ -43,7 +49,7 @@ static enum handler_return handle_border_collision(struct ear *me __attribute__(
     struct msg offside_msg = {.type = MSG_OFFSIDE};
     switch (msg->type) {
     case MSG_COLLISION:
-        TELL(((struct collision_msg *)msg)->them->ear, &offside_msg);
+        POST(((struct collision_msg *)msg)->them->ear, &offside_msg);
         return STATE_HANDLED;
     default:
         return STATE_IGNORED;
@@ -58,6 +64,7 @@ static struct {
 static void construct_border(void)
 {
     border.base.handler = handle_border_collision;
+    border.base.interests = MSG_INTEREST(MSG_COLLISION);
     float screen_radius = 10. + sqrtf(powf(viewport_w/2, 2)+powf(viewport_h/2,2));
     border.body = body_new(viewport_w/2. + I*(viewport_h/2.), screen_radius);
     border.body->affiliation = AFFILIATION_BORDER;
@@ -65,6 +72,84 @@ static void construct_border(void)
     border.body->ear = &border.base;
 }
 
+/* Levels publish checkpoints, and the player going down sends us
+ * back to the last one.  Both happen right after the pending messages
+ * are dispatched, when the queue is empty and the level strand is
+ * suspended, so the tracked state is all the state there is. */
+static struct {
+    struct ear base;
+    struct msg_subscription subscriptions[2];
+    bool wants_checkpoint, wants_retry;
+    snapshot last;
+} checkpoints;
+
+static enum handler_return handle_checkpoints(struct ear *me __attribute__((unused)),
+                                              struct msg *msg)
+{
+    switch (msg->type) {
+    case MSG_CHECKPOINT:
+        checkpoints.wants_checkpoint = true;
+        return STATE_HANDLED;
+    case MSG_PLAYER_DOWN:
+        checkpoints.wants_retry = true;
+        return STATE_HANDLED;
+    default:
+        return STATE_IGNORED;
+    }
+}
+
+static void construct_checkpoints(void)
+{
+    memset(&checkpoints, 0, sizeof (checkpoints));
+    /* the start of the level is the first checkpoint */
+    checkpoints.wants_checkpoint = true;
+    checkpoints.base.handler = handle_checkpoints;
+    msg_subscribe(&checkpoints.subscriptions[0], &checkpoints.base, MSG_CHECKPOINT);
+    msg_subscribe(&checkpoints.subscriptions[1], &checkpoints.base, MSG_PLAYER_DOWN);
+}
+
+static void track_world(struct level *level)
+{
+    snapshot_untrack_all();
+    bodies_snapshot_regions(snapshot_track);
+    components_snapshot_regions(snapshot_track);
+    actors_snapshot_regions(snapshot_track);
+    projectiles_snapshot_regions(snapshot_track);
+    emitters_snapshot_regions(snapshot_track);
+    stage_snapshot_regions(snapshot_track);
+    scheduler_snapshot_regions(level->scheduler, snapshot_track);
+    snapshot_track(&world_camera, sizeof (world_camera));
+    snapshot_track_hook(&msg_bus_snapshot_hook);
+}
+
+static enum outcome update_checkpoints(struct game *game, struct level *level)
+{
+    if (checkpoints.wants_retry) {
+        checkpoints.wants_retry = false;
+        if (0 == --game->lives)
+            return OUTCOME_OUT_OF_LIVES;
+        if (checkpoints.last)
+            snapshot_restore(checkpoints.last);
+    }
+    if (checkpoints.wants_checkpoint) {
+        checkpoints.wants_checkpoint = false;
+        track_world(level);
+        checkpoints.last = snapshot_take(checkpoints.last);
+        LOG_DEBUG("Checkpoint: %zu bytes", snapshot_size(checkpoints.last));
+    }
+    return NO_OUTCOME;
+}
+
+static void destroy_checkpoints(void)
+{
+    if (checkpoints.last)
+        snapshot_destroy(checkpoints.last);
+    snapshot_untrack_all();
+    for (int i = 0; i < 2; ++i)
+        msg_unsubscribe(&checkpoints.subscriptions[i]);
+    checkpoints.last = NULL;
+}
+
 #ifdef DEBUG
 #include "draw.h"
 
@@ -77,8 +162,12 @@ static void draw_collision_region(struct body *b)
 static enum outcome inner_game_loop(strand self, struct game *game)
 {
     bodies_init(MAX_N_BODIES);
+    components_init();
     projectiles_init(MAX_N_PROJECTILES);
+    emitters_init(MAX_N_EMITTERS);
+    msg_queue_init(MSG_QUEUE_BYTES);
     construct_border();
+    construct_checkpoints();
 
     actors_init(MAX_N_ACTORS, global_archetypes, ARCHETYPE_LAST);
     struct level *level = level_load(game->level);
@@ -98,7 +187,12 @@ static enum outcome inner_game_loop(strand self, struct game *game)
         float elapsed_time = strand_yield(self);
         stage_update(elapsed_time);
         bodies_update(elapsed_time);
-        strand_resume(level->strand, elapsed_time);
+        emitters_update(elapsed_time);
+        projectiles_update(elapsed_time);
+        /* collision handlers post their consequences */
+        msg_dispatch_pending();
+        outcome = update_checkpoints(game, level);
+        scheduler_update(level->scheduler, elapsed_time);
         actors_update(elapsed_time);
         osd_update(elapsed_time);
 
@@ -109,6 +203,10 @@ static enum outcome inner_game_loop(strand self, struct game *game)
         }
 
         if (inputs[IN_MENU]) world_camera.scaling += 0.01f;
+#ifdef MSG_TRACE
+        if (JUST_PRESSED == inputs[IN_MENU] && !msg_trace_dump("msg_trace.log"))
+            LOG_ERROR("Couldn't dump the message trace");
+#endif
         if (inputs[IN_QUIT])
             outcome = OUTCOME_QUIT;
 
@@ -116,10 +214,18 @@ static enum outcome inner_game_loop(strand self, struct game *game)
             outcome = OUTCOME_NEXT_LEVEL;
     } while (NO_OUTCOME == outcome);
 
+    struct msg level_end = {.type = MSG_LEVEL_END};
+    msg_publish(&level_end);
+
+    destroy_checkpoints();
     osd_destroy();
     level_destroy(level);
     actors_destroy();
+    msg_bus_destroy();
+    msg_queue_destroy();
+    emitters_destroy();
     projectiles_destroy();
+    components_destroy();
     bodies_destroy();
 
     return outcome;
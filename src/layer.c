@@ -31,10 +31,17 @@ void layer_destroy(struct layer *t)
     free(t);
 }
 
+void layer_snapshot_regions(struct layer *t, snapshot_region_fn fn)
+{
+    fn(t, sizeof (*t));
+    fn(t->ring, RING_SIZE * sizeof (*t->ring));
+}
+
 void layer_update(struct layer *t, float elapsed_time)
 {
     // XXX check if there's a scroll limit; if so, stop
     t->position += elapsed_time * t->speed;
+    t->distance += elapsed_time * t->speed;
 }
 
 static inline int succ(int i) { return (i + 1) & RING_MASK; }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "tilemap.h"
+#include "snapshot.h"
 
 struct layer {
     struct tilemap *(*next_fn)(void *);
@@ -12,6 +13,7 @@ struct layer {
     struct tilemap **ring;
     unsigned first, last;
     float position;
+    double distance;            /* total scrolled so far */
 };
 
 enum { MINIMUM_CHUNK_HEIGHT = 16*8 };  /* Tilemaps must be at least 8 tiles high */
@@ -20,5 +22,6 @@ extern struct layer *layer_new(int direction, struct tilemap *(*fn)(void *), voi
 extern void layer_destroy(struct layer *t);
 extern void layer_update(struct layer *t, float elapsed_time);
 extern void layer_draw(struct layer *t);
+extern void layer_snapshot_regions(struct layer *t, snapshot_region_fn fn);
 
 
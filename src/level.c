@@ -8,25 +8,40 @@
 #include "stage.h"
 #include "video.h"
 #include "actor.h"
+#include "enemy.h"
+#include "emitter.h"
 #include "music.h"
+#include "log.h"
 
 #include <SDL2/SDL.h>
 
 
+struct distance_goal {
+    struct layer *layer;
+    double goal;
+};
+
+static bool is_far_enough(void *data)
+{
+    struct distance_goal *g = data;
+    return g->layer->distance >= g->goal;
+}
+
 static void wait_for_n_screens(strand self, struct layer *layer, float n_screens)
 {
-    double distance = 0.;
-    while (distance < (viewport_h * n_screens)) {
-        float elapsed_time = strand_yield(self);
-        distance += layer->speed * elapsed_time;
-    }
+    struct distance_goal g = { .layer = layer, .goal = layer->distance + viewport_h * n_screens };
+    strand_wait_until(self, is_far_enough, &g);
+}
+
+static void checkpoint(void)
+{
+    struct msg m = { .type = MSG_CHECKPOINT };
+    msg_publish(&m);
 }
 
 static void wait_for_elapsed_time(strand self, float goal)
 {
-    double accum = 0.;
-    while (accum < goal)
-        accum += strand_yield(self);
+    strand_sleep(self, goal);
 }
 
 static void ease_to_scroll_speed(strand self, struct layer *layer, float final,
@@ -43,24 +58,48 @@ static void ease_to_scroll_speed(strand self, struct layer *layer, float final,
     layer->speed = final;
 }
 
+/* No boss to speak of yet, just its guns. */
+static void boss_guns(strand self, struct actor *player, float duration)
+{
+    position guns = viewport_w/2. + I*80.;
+    struct emitter_params spiral = {
+        .pattern = EMITTER_SPIRAL, .type = PROJECTILE_ORB,
+        .affiliation = PROJECTILE_DEFAULT_AFFILIATION,
+        .count = 4, .angular_step = .2, .interval = .15,
+        .speed_curve = { .initial = .2, .duration = .8, .easing = easing_cubic }
+    }, aimed = {
+        .pattern = EMITTER_AIMED, .type = PROJECTILE_PELLET,
+        .affiliation = PROJECTILE_DEFAULT_AFFILIATION,
+        .count = 5, .angular_step = .15, .interval = .6,
+        .target = player->body
+    };
+    emitter e[2];
+    ENSURE(e[0] = emitter_new(&spiral, NULL, guns));
+    ENSURE(e[1] = emitter_new(&aimed, NULL, guns));
+    wait_for_elapsed_time(self, duration);
+    emitter_destroy(e[0]);
+    emitter_destroy(e[1]);
+}
+
 struct next_context {
+    struct tilemap slices[3];
     int count;
 };
 
+static struct tilemap *next(void *data)
+{
+    struct next_context *ctx = data;
+    switch (ctx->count++) {
+    case 0: return &ctx->slices[0];
+    case 1: return &ctx->slices[1];
+    default: return &ctx->slices[2];
+    };
+}
+
 static void level1_entry(strand self)
 {
-    struct tilemap slices[3];
     struct next_context context = {0};
 
-    struct tilemap *next(void *data) {
-        struct next_context *ctx = data;
-        switch (ctx->count++) {
-        case 0: return &slices[0];
-        case 1: return &slices[1];
-        default: return &slices[2];
-        };
-    };
-
     // load music and cue playback
     music_handle level_music, boss_music;
     ENSURE(level_music = music_load("mus/level1.ogg"));
@@ -68,9 +107,9 @@ static void level1_entry(strand self)
     music_play(level_music);
 
     // load chunks
-    ENSURE(tilemap_load("data/slice1.map", "data/slice1.png", &slices[0]));
-    ENSURE(tilemap_load("data/slice2.map", "data/slice2.png", &slices[1]));
-    ENSURE(tilemap_load("data/slice3.map", "data/slice3.png", &slices[2]));
+    ENSURE(tilemap_load("data/slice1.map", "data/slice1.png", &context.slices[0]));
+    ENSURE(tilemap_load("data/slice2.map", "data/slice2.png", &context.slices[1]));
+    ENSURE(tilemap_load("data/slice3.map", "data/slice3.png", &context.slices[2]));
 
     struct layer *main_layer = layer_new(SCROLL_UP, next, &context);
     stage_add_layer(main_layer);
@@ -82,23 +121,26 @@ static void level1_entry(strand self)
 
     strand_yield(self);
     /* we're finished setting up */
+    checkpoint();
 
     ease_to_scroll_speed(self, main_layer, 200.f, 3., easing_cubic);
     wait_for_n_screens(self, main_layer, 1);
 
     // group 1
     {
-        unsigned group_ctr = 0;
-        struct { unsigned *group_ctr; } enemy_aux = { .group_ctr = &group_ctr };
-        struct actor *enemies[2];
-        enemies[0] = actor_spawn(ARCHETYPE_WAVE_ENEMY, viewport_w/2. + I*50.f, &enemy_aux);
-        enemies[1] = actor_spawn(ARCHETYPE_WAVE_ENEMY, viewport_w/2. - 100.f + I*50.f, &enemy_aux);
-        group_ctr = 2;
-        while (group_ctr > 0) strand_yield(self);
+        enum { N = 2 };
+        struct strand_latch group;
+        strand_latch_init(&group, N);
+        struct enemy_a enemy = { .group = &group };
+        ENSURE(actors_spawn_wave(ARCHETYPE_WAVE_ENEMY, (struct formation){FORMATION_LINE, 100.f},
+                                 N, viewport_w/2. - 50.f + I*50.f, &enemy, NULL));
+        strand_latch_wait(self, &group);
     }
+    checkpoint();
 
     music_play(boss_music);
     ease_to_scroll_speed(self, main_layer, 0.f, 6., easing_cubic);
+    boss_guns(self, player, 10.);
     wait_for_elapsed_time(self, 5.);
 
     music_fade_out(5.);
@@ -108,15 +150,16 @@ static void level1_entry(strand self)
 
     layer_destroy(main_layer);
     for (int i = 0; i < 3; ++i)
-        tilemap_destroy(&slices[i]);
+        tilemap_destroy(&context.slices[i]);
 }
 
 
 static struct {
+    const char *name;
     void (*fn)(strand);
     size_t fn_stack_size;
 } levels[N_LEVELS] = {
-    { .fn = level1_entry, .fn_stack_size = STRAND_DEFAULT_STACK_SIZE }
+    { .name = "level1", .fn = level1_entry, .fn_stack_size = STRAND_DEFAULT_STACK_SIZE }
 };
 
 struct level *level_load(unsigned i)
@@ -125,13 +168,26 @@ struct level *level_load(unsigned i)
     struct level *level;
     ENSURE(i < N_LEVELS);
     ENSURE(level = calloc(1, sizeof (*level)));
-    level->strand = strand_spawn_0(levels[i].fn, levels[i].fn_stack_size);
+    level->strand = strand_spawn_named_0(levels[i].fn, levels[i].fn_stack_size, levels[i].name);
+    level->scheduler = scheduler_new();
+    scheduler_add(level->scheduler, level->strand);
     return level;
 }
 
+static void dump_stats(strand st, void *data __attribute__ ((unused)))
+{
+    struct strand_stats stats;
+    strand_stats(st, &stats);
+    LOG_DEBUG("strand %s: %lu resumes, %.3fms total, %.3fms max, %zu words of stack",
+              stats.name, stats.n_resumes, stats.total_seconds * 1e3,
+              stats.max_seconds * 1e3, stats.stack_high_water);
+}
+
 void level_destroy(struct level *level)
 {
     stage_end();
+    strand_foreach(dump_stats, NULL);
+    scheduler_destroy(level->scheduler);
     strand_destroy(level->strand);
     free(level);
 }
@@ -4,6 +4,7 @@
 
 struct level {
     strand strand;
+    scheduler scheduler;
 };
 
 extern struct level *level_load(unsigned level);
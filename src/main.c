@@ -7,6 +7,8 @@
 #include "input.h"
 #include "game.h"
 #include "inline_math.h"
+#include "log.h"
+#include "msg.h"
 
 double average_frame_time;
 
@@ -39,20 +41,31 @@ int main(/* int argc, char **argv */)
 {
     video_init();
     input_init();
+#ifdef MSG_TRACE
+    msg_trace_dump_on_abort("msg_trace.log");
+#endif
 
     strand game_strand;
-    // XXX how much stack do we need?  This stack needs to be quite
-    // large because things like shaders get compiled on it.
+    // This stack needs to be quite large because things like shaders
+    // get compiled on it.  Strand stacks are committed lazily, so
+    // being generous only costs address space; see the high-water
+    // mark logged below if you want to trim it.
     game_strand = strand_spawn_0(game_entry_point, 256*1024);
+    scheduler game_scheduler = scheduler_new();
+    scheduler_add(game_scheduler, game_strand);
 
     do {
         float elapsed_time = update_frame_timer();
 
         video_start_frame();
-        strand_resume(game_strand, elapsed_time);
+        scheduler_update(game_scheduler, elapsed_time);
+        msg_trace_next_frame();
         video_end_frame();
         input_update();
     } while(strand_is_alive(game_strand));
 
+    scheduler_destroy(game_scheduler);
+
+    LOG_DEBUG("game strand stack high water: %zu words", strand_stack_high_water(game_strand));
     return 0;
 }
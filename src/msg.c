@@ -1,25 +1,542 @@
+#include <stdalign.h>
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef MSG_TRACE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#endif
 
 #include "msg.h"
 #include "msg_macros.h"
 #include "ensure.h"
 
+static struct msg_state **chain_of(struct msg_state *state)
+{
+    if (state->depth) return state->chain;
+    unsigned depth = 0;
+    for (struct msg_state *p = state; p; p = p->parent)
+        ++depth;
+    ENSURE(depth <= MSG_MAX_STATE_DEPTH);
+    unsigned i = depth;
+    for (struct msg_state *p = state; p; p = p->parent)
+        state->chain[--i] = p;
+    state->depth = depth;
+    return state->chain;
+}
+
+static void enter(struct ear *ear, msg_handler handler)
+{
+    struct msg enter = {.type = MSG_ENTER};
+    enum handler_return r = (*handler)(ear, &enter);
+    ENSURE(r == STATE_HANDLED || r == STATE_IGNORED);
+}
+
+/* Enters the target state's ancestors below depth lca, then the
+ * target itself. */
+static void enter_down_to(struct ear *ear, struct msg_state *target, unsigned lca)
+{
+    struct msg_state **chain = chain_of(target);
+    for (unsigned i = lca; i < target->depth; ++i)
+        enter(ear, chain[i]->handler);
+}
+
+#ifdef MSG_TRACE
+static void trace(struct ear *, msg_handler, struct msg *, enum handler_return, double start);
+static double trace_clock(void);
+#endif
+
+static enum handler_return tell(struct ear *ear, struct msg *msg);
+
 void ear_tell(struct ear *ear, struct msg *msg)
 {
+#ifdef MSG_TRACE
     if (NULL == ear) return;
+    msg_handler handler = ear->handler;
+    double start = trace_clock();
+    enum handler_return r = tell(ear, msg);
+    trace(ear, handler, msg, r, start);
+#else
+    tell(ear, msg);
+#endif
+}
+
+static enum handler_return tell(struct ear *ear, struct msg *msg)
+{
+    if (NULL == ear) return STATE_IGNORED;
     msg_handler s = ear->handler;
-    if (NULL == s) return;
-    enum handler_return r = (*s)(ear, msg);
-    if (STATE_TRANSITION != r) return;
-
-    struct msg exit = {.type = MSG_EXIT},
-              enter = {.type = MSG_ENTER};
-    (*s)(ear, &exit);
-    if (NULL == ear->handler) return;
-    r = (*ear->handler)(ear, &enter);
-    ENSURE(r == STATE_HANDLED || r == STATE_IGNORED);
+    if (NULL == s || !ear_hears(ear, msg->type)) return STATE_IGNORED;
+    struct msg_state *from = ear->state;
+    enum handler_return r;
+    if (NULL == from)
+        r = (*s)(ear, msg);
+    else {
+        struct msg_state **chain = chain_of(from);
+        int i = from->depth;
+        do r = (*chain[--i]->handler)(ear, msg);
+        while (STATE_IGNORED == r && i > 0);
+    }
+    if (STATE_TRANSITION != r) return r;
+
+    struct msg exit = {.type = MSG_EXIT};
+    struct msg_state *to = ear->state;
+    unsigned lca = 0;
+    if (NULL == from)
+        (*s)(ear, &exit);
+    else {
+        struct msg_state **chain = chain_of(from);
+        if (to) {
+            struct msg_state **to_chain = chain_of(to);
+            while (lca < from->depth && lca < to->depth && chain[lca] == to_chain[lca])
+                ++lca;
+            /* a transition to oneself or an ancestor re-enters it */
+            if (lca == to->depth) --lca;
+        }
+        for (unsigned i = from->depth; i > lca; --i)
+            (*chain[i-1]->handler)(ear, &exit);
+    }
+    ear->interests = 0;
+    if (to)
+        enter_down_to(ear, to, lca);
+    else if (ear->handler)
+        enter(ear, ear->handler);
+    return r;
+}
+
+void ear_enter_state(struct ear *ear, struct msg_state *state)
+{
+    ear->state = state;
+    ear->handler = state->handler;
+    ear->interests = 0;
+    enter_down_to(ear, state, 0);
 }
 
+/* Two queues, so that handlers can post to one while we drain the
+ * other.  Each is an arena of message bytes plus an index of who
+ * gets what, which we sort by receiver before delivery. */
+struct posting {
+    struct ear *ear;
+    size_t offset;
+    unsigned long sequence;
+};
+
+static struct msg_queue {
+    uint8_t *arena;
+    size_t arena_used, arena_size;
+    struct posting *postings;
+    size_t n_postings, postings_size;
+} queues[2], *front;
+
+static unsigned long sequence;
+
+enum { MAX_DRAIN_ROUNDS = 16 };
+
+void msg_queue_init(size_t initial_bytes)
+{
+    ENSURE(initial_bytes > 0);
+    for (int i = 0; i < 2; ++i) {
+        struct msg_queue *q = &queues[i];
+        *q = (struct msg_queue){ .arena_size = initial_bytes,
+                                 .postings_size = 1 + initial_bytes / sizeof (struct msg) };
+        ENSURE(q->arena = malloc(q->arena_size));
+        ENSURE(q->postings = malloc(q->postings_size * sizeof (*q->postings)));
+    }
+    front = &queues[0];
+    sequence = 0;
+}
+
+void msg_queue_destroy(void)
+{
+    for (int i = 0; i < 2; ++i) {
+        free(queues[i].arena);
+        free(queues[i].postings);
+        queues[i] = (struct msg_queue){0};
+    }
+    front = NULL;
+}
+
+void ear_post(struct ear *ear, struct msg *msg, size_t size)
+{
+    if (NULL == ear) return;
+    ENSURE(front);
+    struct msg_queue *q = front;
+    const size_t align = alignof (max_align_t);
+    size_t offset = (q->arena_used + align - 1) & ~(align - 1);
+    if (offset + size > q->arena_size) {
+        while (offset + size > q->arena_size) q->arena_size *= 2;
+        ENSURE(q->arena = realloc(q->arena, q->arena_size));
+    }
+    if (q->n_postings == q->postings_size) {
+        q->postings_size *= 2;
+        ENSURE(q->postings = realloc(q->postings, q->postings_size * sizeof (*q->postings)));
+    }
+    memcpy(q->arena + offset, msg, size);
+    q->arena_used = offset + size;
+    q->postings[q->n_postings++] = (struct posting){ .ear = ear, .offset = offset,
+                                                     .sequence = sequence++ };
+}
+
+static int by_receiver(const void *a_, const void *b_)
+{
+    const struct posting *a = a_, *b = b_;
+    if (a->ear != b->ear) return (uintptr_t)a->ear < (uintptr_t)b->ear ? -1 : 1;
+    return a->sequence < b->sequence ? -1 : a->sequence > b->sequence;
+}
+
+void msg_dispatch_pending(void)
+{
+    ENSURE(front);
+    for (int round = 0; front->n_postings > 0; ++round) {
+        /* Handlers posting to each other forever is a bug. */
+        ENSURE(round < MAX_DRAIN_ROUNDS);
+        struct msg_queue *q = front;
+        front = (front == &queues[0]) ? &queues[1] : &queues[0];
+        qsort(q->postings, q->n_postings, sizeof (*q->postings), by_receiver);
+        for (size_t i = 0; i < q->n_postings; ++i)
+            ear_tell(q->postings[i].ear, (struct msg *)(q->arena + q->postings[i].offset));
+        q->n_postings = 0;
+        q->arena_used = 0;
+    }
+}
+
+
+/* The bus keeps a dense array of subscriptions per type, growing
+ * the table of types as they are first subscribed to.  While
+ * publishing, unsubscribing just leaves a hole, which we fill in once
+ * the outermost publish is done, so that the walk doesn't skip or
+ * repeat anyone. */
+struct subscribers {
+    struct msg_subscription **each;
+    size_t n, capacity, n_holes;
+};
+
+static struct {
+    struct subscribers *by_type;
+    size_t n_types;
+    unsigned publishing;
+} bus;
+
+static struct subscribers *subscribers_of(msg_type type)
+{
+    if (type >= bus.n_types) {
+        size_t n = bus.n_types ? bus.n_types : MSG_USER + 1;
+        while (n <= type) n *= 2;
+        ENSURE(bus.by_type = realloc(bus.by_type, n * sizeof (*bus.by_type)));
+        memset(bus.by_type + bus.n_types, 0, (n - bus.n_types) * sizeof (*bus.by_type));
+        bus.n_types = n;
+    }
+    return &bus.by_type[type];
+}
+
+static void swap_remove(struct subscribers *list, size_t i)
+{
+    list->each[i] = list->each[--list->n];
+    if (list->each[i]) list->each[i]->index = i;
+}
+
+void msg_subscribe(struct msg_subscription *sub, struct ear *ear, msg_type type)
+{
+    ENSURE(NULL == sub->ear && ear);
+    struct subscribers *list = subscribers_of(type);
+    if (list->n == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 8;
+        ENSURE(list->each = realloc(list->each, list->capacity * sizeof (*list->each)));
+    }
+    *sub = (struct msg_subscription){ .ear = ear, .type = type, .index = list->n };
+    list->each[list->n++] = sub;
+}
+
+void msg_unsubscribe(struct msg_subscription *sub)
+{
+    if (NULL == sub->ear) return;
+    struct subscribers *list = &bus.by_type[sub->type];
+    ENSURE(sub->index < list->n && list->each[sub->index] == sub);
+    if (bus.publishing) {
+        list->each[sub->index] = NULL;
+        ++list->n_holes;
+    } else
+        swap_remove(list, sub->index);
+    sub->ear = NULL;
+}
+
+static void fill_holes(void)
+{
+    for (size_t t = 0; t < bus.n_types; ++t) {
+        struct subscribers *list = &bus.by_type[t];
+        for (size_t i = list->n; list->n_holes > 0 && i-- > 0;)
+            if (NULL == list->each[i]) {
+                swap_remove(list, i);
+                --list->n_holes;
+            }
+    }
+}
+
+void msg_publish(struct msg *msg)
+{
+    if (msg->type >= bus.n_types) return;
+    ++bus.publishing;
+    /* Handlers may subscribe, moving any of this. */
+    for (size_t i = 0, n = bus.by_type[msg->type].n; i < n; ++i) {
+        struct msg_subscription *sub = bus.by_type[msg->type].each[i];
+        if (sub) ear_tell(sub->ear, msg);
+    }
+    if (0 == --bus.publishing)
+        fill_holes();
+}
+
+size_t msg_subscriber_count(msg_type type)
+{
+    if (type >= bus.n_types) return 0;
+    struct subscribers *list = &bus.by_type[type];
+    return list->n - list->n_holes;
+}
+
+static size_t bus_snapshot_size(void)
+{
+    size_t size = sizeof (size_t);
+    for (size_t t = 0; t < bus.n_types; ++t)
+        size += sizeof (size_t) + bus.by_type[t].n * sizeof (struct msg_subscription *);
+    return size;
+}
+
+static void bus_save(void *out)
+{
+    ENSURE(0 == bus.publishing);
+    uint8_t *q = out;
+    memcpy(q, &bus.n_types, sizeof (size_t));
+    q += sizeof (size_t);
+    for (size_t t = 0; t < bus.n_types; ++t) {
+        struct subscribers *list = &bus.by_type[t];
+        memcpy(q, &list->n, sizeof (size_t));
+        q += sizeof (size_t);
+        memcpy(q, list->each, list->n * sizeof (*list->each));
+        q += list->n * sizeof (*list->each);
+    }
+}
+
+static void bus_restore(const void *in, size_t size)
+{
+    ENSURE(0 == bus.publishing);
+    const uint8_t *q = in;
+    size_t n_types;
+    memcpy(&n_types, q, sizeof (size_t));
+    q += sizeof (size_t);
+    if (n_types) subscribers_of(n_types - 1);
+    for (size_t t = 0; t < bus.n_types; ++t) {
+        struct subscribers *list = &bus.by_type[t];
+        size_t n = 0;
+        if (t < n_types) {
+            memcpy(&n, q, sizeof (size_t));
+            q += sizeof (size_t);
+        }
+        if (n > list->capacity) {
+            list->capacity = n;
+            ENSURE(list->each = realloc(list->each, n * sizeof (*list->each)));
+        }
+        memcpy(list->each, q, n * sizeof (*list->each));
+        q += n * sizeof (*list->each);
+        list->n = n;
+        list->n_holes = 0;
+    }
+    ENSURE(q == (const uint8_t *)in + size);
+}
+
+const struct snapshot_hook msg_bus_snapshot_hook = {
+    .size = bus_snapshot_size, .save = bus_save, .restore = bus_restore
+};
+
+void msg_bus_destroy(void)
+{
+    ENSURE(0 == bus.publishing);
+    for (size_t t = 0; t < bus.n_types; ++t) {
+        struct subscribers *list = &bus.by_type[t];
+        for (size_t i = 0; i < list->n; ++i)
+            list->each[i]->ear = NULL;
+        free(list->each);
+    }
+    free(bus.by_type);
+    bus.by_type = NULL;
+    bus.n_types = 0;
+}
+
+#ifdef MSG_TRACE
+/* Records are claimed with an atomic increment, so any thread may
+ * tell; a dump racing with a tell may see a half-written record,
+ * which we'll live with. */
+struct trace_record {
+    unsigned long frame;
+    msg_type type;
+    enum handler_return result;
+    struct ear *ear;
+    msg_handler handler;
+    float duration;
+};
+
+enum { N_TRACED_TYPES = 32 };  /* anything beyond is lumped into the last */
+
+struct trace_counts {
+    unsigned long n[N_TRACED_TYPES];
+    double seconds[N_TRACED_TYPES];
+};
+
+static struct {
+    struct trace_record ring[MSG_TRACE_RING_SIZE];
+    atomic_ulong head;
+    unsigned long frame;
+    struct trace_counts this_frame, last_frame;
+    char abort_path[256];
+} tracer;
+
+static double trace_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void trace(struct ear *ear, msg_handler handler, struct msg *msg,
+                  enum handler_return result, double start)
+{
+    float duration = trace_clock() - start;
+    unsigned long i = atomic_fetch_add_explicit(&tracer.head, 1, memory_order_relaxed);
+    tracer.ring[i % MSG_TRACE_RING_SIZE] = (struct trace_record){
+        .frame = tracer.frame, .type = msg->type, .result = result,
+        .ear = ear, .handler = handler, .duration = duration
+    };
+    unsigned t = (unsigned)msg->type < N_TRACED_TYPES ? msg->type : N_TRACED_TYPES-1;
+    ++tracer.this_frame.n[t];
+    tracer.this_frame.seconds[t] += duration;
+}
+
+void msg_trace_next_frame(void)
+{
+    tracer.last_frame = tracer.this_frame;
+    memset(&tracer.this_frame, 0, sizeof (tracer.this_frame));
+    ++tracer.frame;
+}
+
+static const char *type_names[] = {
+    [MSG_ENTER] = "ENTER", [MSG_EXIT] = "EXIT", [MSG_TICK] = "TICK",
+    [MSG_OFFSIDE] = "OFFSIDE", [MSG_COLLISION] = "COLLISION",
+    [MSG_DAMAGE] = "DAMAGE", [MSG_LEVEL_END] = "LEVEL_END",
+    [MSG_CHECKPOINT] = "CHECKPOINT", [MSG_PLAYER_DOWN] = "PLAYER_DOWN"
+};
+
+static const char *type_name(msg_type type, char *buf, size_t size)
+{
+    if (type < MSG_USER) return type_names[type];
+    snprintf(buf, size, "USER+%u", (unsigned)(type - MSG_USER));
+    return buf;
+}
+
+/* Lines for the dump are built by hand, since stdio isn't
+ * async-signal-safe. */
+struct line {
+    char buf[160];
+    size_t n;
+};
+
+static void put_str(struct line *l, const char *s)
+{
+    while (*s && l->n < sizeof (l->buf)) l->buf[l->n++] = *s++;
+}
+
+static void put_uint(struct line *l, unsigned long x, unsigned base, int min_digits)
+{
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = "0123456789abcdef"[x % base];
+        x /= base;
+    } while (x || n < min_digits);
+    while (n > 0 && l->n < sizeof (l->buf)) l->buf[l->n++] = digits[--n];
+}
+
+static void put_ptr(struct line *l, uintptr_t p)
+{
+    put_str(l, "0x");
+    put_uint(l, p, 16, 1);
+}
+
+/* Only write and the above, so that we can get away with calling
+ * this from a signal handler. */
+static void dump_to(int fd)
+{
+    static const char *results[] = { "ignored", "handled", "transition" };
+    unsigned long head = atomic_load(&tracer.head),
+        first = head > MSG_TRACE_RING_SIZE ? head - MSG_TRACE_RING_SIZE : 0;
+    for (unsigned long i = first; i < head; ++i) {
+        struct trace_record *r = &tracer.ring[i % MSG_TRACE_RING_SIZE];
+        struct line l = { .n = 0 };
+        put_uint(&l, r->frame, 10, 1);
+        put_str(&l, " ");
+        if (r->type < MSG_USER) {
+            put_str(&l, type_names[r->type]);
+        } else {
+            put_str(&l, "USER+");
+            put_uint(&l, r->type - MSG_USER, 10, 1);
+        }
+        put_str(&l, " ");
+        put_ptr(&l, (uintptr_t)r->ear);
+        put_str(&l, " ");
+        put_ptr(&l, (uintptr_t)r->handler);
+        put_str(&l, " ");
+        put_str(&l, results[r->result]);
+        unsigned long ns = r->duration * 1e9 + .5;
+        put_str(&l, " ");
+        put_uint(&l, ns / 1000, 10, 1);
+        put_str(&l, ".");
+        put_uint(&l, ns % 1000, 10, 3);
+        put_str(&l, "us\n");
+        if (write(fd, l.buf, l.n) < 0) return;
+    }
+}
+
+bool msg_trace_dump(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    dump_to(fd);
+    return 0 == close(fd);
+}
+
+static void dump_and_abort(int sig)
+{
+    int fd = open(tracer.abort_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        dump_to(fd);
+        close(fd);
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void msg_trace_dump_on_abort(const char *path)
+{
+    snprintf(tracer.abort_path, sizeof (tracer.abort_path), "%s", path);
+    signal(SIGABRT, dump_and_abort);
+}
+
+void msg_trace_summary(char *buf, size_t size)
+{
+    unsigned long total = 0;
+    unsigned busiest = 0;
+    for (unsigned t = 0; t < N_TRACED_TYPES; ++t) {
+        total += tracer.last_frame.n[t];
+        if (tracer.last_frame.seconds[t] > tracer.last_frame.seconds[busiest])
+            busiest = t;
+    }
+    char name[16];
+    snprintf(buf, size, "msgs %lu, %s x%lu %.2fms", total,
+             type_name(busiest, name, sizeof (name)), tracer.last_frame.n[busiest],
+             tracer.last_frame.seconds[busiest] * 1e3);
+}
+#endif
 
 
 #ifdef UNIT_TEST_MSG
@@ -46,11 +563,286 @@ static void simple_message_passing_test(void)
     cmp_ok(a.was_called, "==", true);
 }
 
+static void deferred_dispatch_test(void)
+{
+    note("Test posting messages for later delivery");
+    struct counted_msg { struct msg base; int n; };
+    struct testing_ear {
+        struct ear base;
+        int received[8], n_received;
+        struct testing_ear *echo_to;
+    } a = {.base = {0}}, b = {.base = {0}};
+    enum handler_return fn(struct testing_ear *me, struct msg *m) {
+        if (m->type != MSG_USER) return STATE_IGNORED;
+        struct counted_msg *cm = (struct counted_msg *)m;
+        me->received[me->n_received++] = cm->n;
+        if (me->echo_to) {
+            struct counted_msg echo = { .base.type = MSG_USER, .n = cm->n + 100 };
+            POST(me->echo_to, &echo);
+        }
+        return STATE_HANDLED;
+    }
+    a.base.handler = b.base.handler = (msg_handler)fn;
+
+    msg_queue_init(16);
+    struct counted_msg m = { .base.type = MSG_USER };
+    for (m.n = 0; m.n < 6; ++m.n)
+        POST(m.n % 2 ? &b : &a, &m);
+    cmp_ok(a.n_received + b.n_received, "==", 0, "Nothing is delivered before the drain");
+    m.n = -1;
+    msg_dispatch_pending();
+    ok(3 == a.n_received && 0 == a.received[0] && 2 == a.received[1] && 4 == a.received[2],
+       "Each receiver gets its messages in order, copied when posted");
+    ok(3 == b.n_received && 1 == b.received[0] && 3 == b.received[1] && 5 == b.received[2]);
+
+    a.n_received = b.n_received = 0;
+    a.echo_to = &b;
+    m.n = 7;
+    POST(&a, &m);
+    msg_dispatch_pending();
+    ok(1 == a.n_received && 1 == b.n_received && 107 == b.received[0],
+       "Messages posted during the drain are delivered by it");
+    msg_dispatch_pending();
+    cmp_ok(b.n_received, "==", 1);
+    msg_queue_destroy();
+}
+
+static void interest_mask_test(void)
+{
+    note("Test that ears only hear what interests them");
+    struct testing_ear {
+        struct ear base;
+        int n_ticks, n_users, n_enters;
+    } a = {.base = {0}};
+    enum handler_return second(struct testing_ear *me, struct msg *m) {
+        if (MSG_ENTER == m->type) ++me->n_enters;
+        if (MSG_TICK == m->type) ++me->n_ticks;
+        return STATE_HANDLED;
+    }
+    enum handler_return first(struct testing_ear *me, struct msg *m) {
+        switch (m->type) {
+        case MSG_TICK: ++me->n_ticks; return STATE_HANDLED;
+        case MSG_USER:
+            ++me->n_users;
+            me->base.handler = (msg_handler)second;
+            return STATE_TRANSITION;
+        default: return STATE_IGNORED;
+        }
+    }
+    a.base.handler = (msg_handler)first;
+    a.base.interests = MSG_INTEREST(MSG_USER);
+    struct msg tick = {.type = MSG_TICK}, user = {.type = MSG_USER};
+    TELL(&a, &tick);
+    cmp_ok(a.n_ticks, "==", 0, "Uninteresting messages aren't delivered");
+    TELL(&a, &user);
+    ok(1 == a.n_users && 1 == a.n_enters, "Interesting ones are, as are transitions");
+    TELL(&a, &tick);
+    cmp_ok(a.n_ticks, "==", 1, "Transitions clear the mask");
+}
+
+static void hierarchical_state_test(void)
+{
+    note("Test hierarchical states");
+    struct testing_ear {
+        struct ear base;
+        char log[64];
+        int n;
+    } a = {.base = {0}};
+    void record(struct testing_ear *me, char state, struct msg *m) {
+        if (MSG_ENTER == m->type) { me->log[me->n++] = state; me->log[me->n++] = '+'; }
+        if (MSG_EXIT == m->type) { me->log[me->n++] = state; me->log[me->n++] = '-'; }
+        me->log[me->n] = 0;
+    }
+    /* root
+     *  +- left
+     *  |   +- left_leaf
+     *  +- right */
+    static struct msg_state root, left, left_leaf, right;
+    enum handler_return root_fn(struct testing_ear *me, struct msg *m) {
+        record(me, 'R', m);
+        if (MSG_USER == m->type) {
+            me->log[me->n++] = '!';
+            me->log[me->n] = 0;
+            return STATE_HANDLED;
+        }
+        if (MSG_USER+1 == m->type) return XITION_STATE(&right);
+        return STATE_IGNORED;
+    }
+    enum handler_return left_fn(struct testing_ear *me, struct msg *m) {
+        record(me, 'L', m);
+        return STATE_IGNORED;
+    }
+    enum handler_return left_leaf_fn(struct testing_ear *me, struct msg *m) {
+        record(me, 'l', m);
+        if (MSG_USER+2 == m->type) return XITION_STATE(&left_leaf);
+        return STATE_IGNORED;
+    }
+    enum handler_return right_fn(struct testing_ear *me, struct msg *m) {
+        record(me, 'r', m);
+        if (MSG_USER+2 == m->type) return XITION(NULL);
+        return STATE_IGNORED;
+    }
+    root = (struct msg_state){ .handler = (msg_handler)root_fn };
+    left = (struct msg_state){ .handler = (msg_handler)left_fn, .parent = &root };
+    left_leaf = (struct msg_state){ .handler = (msg_handler)left_leaf_fn, .parent = &left };
+    right = (struct msg_state){ .handler = (msg_handler)right_fn, .parent = &root };
+
+    ear_enter_state(&a.base, &left_leaf);
+    is(a.log, "R+L+l+", "Entering a state enters its ancestors first");
+    a.n = 0;
+    struct msg m = {.type = MSG_USER};
+    TELL(&a, &m);
+    is(a.log, "!", "Ignored messages bubble up to the root");
+    a.n = 0;
+    m.type = MSG_USER+2;
+    TELL(&a, &m);
+    is(a.log, "l-l+", "Self-transitions exit and re-enter");
+    a.n = 0;
+    m.type = MSG_USER+1;
+    TELL(&a, &m);
+    is(a.log, "l-L-r+", "Transitions stop at the common ancestor");
+    a.n = 0;
+    m.type = MSG_USER+2;
+    TELL(&a, &m);
+    is(a.log, "r-R-", "Leaving the hierarchy exits everything");
+    ok(NULL == a.base.handler && NULL == a.base.state);
+}
+
+static void publish_subscribe_test(void)
+{
+    note("Test the publish/subscribe bus");
+    enum { N = 5 };
+    struct testing_ear {
+        struct ear base;
+        struct msg_subscription end, custom;
+        int n_heard;
+    } ears[N];
+    enum handler_return fn(struct testing_ear *me, struct msg *m) {
+        ++me->n_heard;
+        /* the first to hear the level end leaves */
+        if (MSG_LEVEL_END == m->type && me == &ears[0])
+            msg_unsubscribe(&me->end);
+        return STATE_HANDLED;
+    }
+    for (int i = 0; i < N; ++i) {
+        ears[i] = (struct testing_ear){ .base.handler = (msg_handler)fn };
+        msg_subscribe(&ears[i].end, &ears[i].base, MSG_LEVEL_END);
+    }
+    msg_subscribe(&ears[3].custom, &ears[3].base, MSG_USER+40);
+    cmp_ok(msg_subscriber_count(MSG_LEVEL_END), "==", N);
+
+    struct msg end = {.type = MSG_LEVEL_END}, custom = {.type = MSG_USER+40};
+    msg_publish(&end);
+    bool all = true;
+    for (int i = 0; i < N; ++i) all &= 1 == ears[i].n_heard;
+    ok(all, "Every subscriber hears a publish exactly once");
+    cmp_ok(msg_subscriber_count(MSG_LEVEL_END), "==", N-1, "Subscribers can leave mid-publish");
+
+    msg_unsubscribe(&ears[2].end);
+    msg_publish(&end);
+    ok(1 == ears[0].n_heard && 2 == ears[1].n_heard && 1 == ears[2].n_heard &&
+       2 == ears[3].n_heard && 2 == ears[4].n_heard, "Unsubscribed ears hear nothing");
+    msg_publish(&custom);
+    cmp_ok(ears[3].n_heard, "==", 3, "User types work too");
+    msg_bus_destroy();
+    ok(NULL == ears[4].end.ear);
+    msg_publish(&end);
+    cmp_ok(ears[4].n_heard, "==", 2);
+}
+
+#ifdef MSG_TRACE
+static void trace_test(void)
+{
+    note("Test message tracing");
+    struct ear a = {0};
+    enum handler_return fn(struct ear *me, struct msg *m) {
+        (void)me;
+        return MSG_TICK == m->type ? STATE_HANDLED : STATE_IGNORED;
+    }
+    a.handler = fn;
+    struct msg tick = {.type = MSG_TICK}, user = {.type = MSG_USER};
+    msg_trace_next_frame();
+    for (int i = 0; i < 3; ++i) TELL(&a, &tick);
+    TELL(&a, &user);
+    msg_trace_next_frame();
+    char summary[64];
+    msg_trace_summary(summary, sizeof (summary));
+    ok(0 == strncmp(summary, "msgs 4,", 7), "The summary counts last frame's messages");
+    cmp_ok(tracer.last_frame.n[MSG_TICK], "==", 3);
+    struct trace_record *r = &tracer.ring[(atomic_load(&tracer.head) - 1) % MSG_TRACE_RING_SIZE];
+    ok(r->ear == &a && r->handler == fn && MSG_USER == r->type && STATE_IGNORED == r->result,
+       "Records say who got what");
+
+    char path[] = "/tmp/msg_trace.XXXXXX";
+    int fd = mkstemp(path);
+    ok(fd >= 0 && msg_trace_dump(path));
+    char buf[4096];
+    ssize_t n = read(fd, buf, sizeof (buf) - 1);
+    buf[n > 0 ? n : 0] = 0;
+    ok(NULL != strstr(buf, " TICK ") && NULL != strstr(buf, " USER+0 "), "Dumps name types");
+    char ear_field[32];
+    snprintf(ear_field, sizeof (ear_field), " %p ", (void *)&a);
+    ok(NULL != strstr(buf, ear_field) && NULL != strstr(buf, "us\n"), "Dumps formatted by hand");
+    close(fd);
+    unlink(path);
+}
+#endif
+
+static void bus_snapshot_test(void)
+{
+    note("Test snapshots of the bus");
+    enum { N = 3 };
+    struct testing_ear {
+        struct ear base;
+        struct msg_subscription sub;
+        int n_heard;
+    } ears[N];
+    enum handler_return fn(struct testing_ear *me, struct msg *m __attribute__((unused))) {
+        ++me->n_heard;
+        return STATE_HANDLED;
+    }
+    for (int i = 0; i < N; ++i)
+        ears[i] = (struct testing_ear){ .base.handler = (msg_handler)fn };
+    msg_subscribe(&ears[0].sub, &ears[0].base, MSG_USER);
+    msg_subscribe(&ears[1].sub, &ears[1].base, MSG_USER);
+    /* the owner of the subscriptions restores those */
+    snapshot_track(ears, sizeof (ears));
+    snapshot_track_hook(&msg_bus_snapshot_hook);
+    snapshot s = snapshot_take(NULL);
+
+    msg_unsubscribe(&ears[0].sub);
+    msg_subscribe(&ears[2].sub, &ears[2].base, MSG_USER+100);
+    snapshot_restore(s);
+    cmp_ok(msg_subscriber_count(MSG_USER), "==", 2);
+    cmp_ok(msg_subscriber_count(MSG_USER+100), "==", 0);
+    struct msg m = {.type = MSG_USER};
+    msg_publish(&m);
+    ok(1 == ears[0].n_heard && 1 == ears[1].n_heard && 0 == ears[2].n_heard,
+       "Restored subscribers hear publishes");
+    msg_unsubscribe(&ears[0].sub);
+    cmp_ok(msg_subscriber_count(MSG_USER), "==", 1, "and can still leave");
+
+    snapshot_destroy(s);
+    snapshot_untrack_all();
+    msg_bus_destroy();
+}
+
 int main(void)
 {
-    plan(2);
+#ifdef MSG_TRACE
+    plan(33);
+#else
+    plan(27);
+#endif
     simple_message_passing_test();
-    // TODO verify hierarchical signal handling
+    deferred_dispatch_test();
+    interest_mask_test();
+    hierarchical_state_test();
+    publish_subscribe_test();
+    bus_snapshot_test();
+#ifdef MSG_TRACE
+    trace_test();
+#endif
     done_testing();
 }
 
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snapshot.h"
+
 typedef enum {
     MSG_ENTER,
     MSG_EXIT,
@@ -8,6 +14,9 @@ typedef enum {
     MSG_OFFSIDE,
     MSG_COLLISION,  /* see physics.h */
     MSG_DAMAGE,     /* see projectile.h */
+    MSG_LEVEL_END,  /* published; see game.c */
+    MSG_CHECKPOINT, /* published by levels; see game.c */
+    MSG_PLAYER_DOWN,/* published by the player; see game.c */
     MSG_USER        /* add more types from here */
 } msg_type;
 
@@ -26,8 +35,93 @@ enum handler_return { STATE_IGNORED, STATE_HANDLED, STATE_TRANSITION };
  * always copy anything they need to hold on to after returning. */
 typedef enum handler_return (*msg_handler)(struct ear *, struct msg *);
 
+/* Hierarchical states: a message the state's handler ignores is
+ * offered to its parent, and so on up to the root.  A transition
+ * exits states up to the least common ancestor of the source and
+ * target, then enters down to the target.  Each state's chain of
+ * ancestors is worked out the first time the state is used, so
+ * states should be static, and their hierarchy fixed. */
+enum { MSG_MAX_STATE_DEPTH = 8 };
+struct msg_state {
+    msg_handler handler;
+    struct msg_state *parent;
+    /* filled in on first use */
+    unsigned depth;
+    struct msg_state *chain[MSG_MAX_STATE_DEPTH];  /* root first */
+};
+
+/* An ear is either in a flat state, just a handler, or in a
+ * hierarchical one, in which case handler is state->handler.
+ *
+ * interests is a mask of MSG_INTEREST(type) bits for the messages
+ * the current handler wants; zero means all of them.  Types past the
+ * width of the mask, and MSG_ENTER and MSG_EXIT, are always heard.
+ * It is cleared on every transition, so a state that wants to be
+ * spared messages sets it when it handles MSG_ENTER.  In a hierarchy,
+ * that includes anything its ancestors handle. */
 struct ear {
     msg_handler handler;
+    uint32_t interests;
+    struct msg_state *state;
 };
 
+#define MSG_INTEREST(type) ((uint32_t)1 << (type))
+
+static inline bool ear_hears(struct ear *ear, msg_type type)
+{
+    return 0 == ear->interests || type >= 32 || type <= MSG_EXIT ||
+        (ear->interests & MSG_INTEREST(type));
+}
+
 extern void ear_tell(struct ear *, struct msg *);
+/* Puts the ear in state, entering each of its ancestors on the way. */
+extern void ear_enter_state(struct ear *, struct msg_state *);
+
+/* Deferred delivery: ear_post copies size bytes of the message into a
+ * queue, to be told when msg_dispatch_pending is next called, so it's
+ * safe to post from inside iterations over pools that the receiver's
+ * handler might modify.  The drain delivers each receiver's messages
+ * together, in the order they were posted, and keeps going until
+ * messages posted by handlers during the drain have been delivered
+ * too.  Receivers must stay valid until then. */
+extern void msg_queue_init(size_t initial_bytes);
+extern void msg_queue_destroy(void);
+extern void ear_post(struct ear *, struct msg *, size_t size);
+extern void msg_dispatch_pending(void);
+
+/* Publish/subscribe: msg_publish tells the message to every ear
+ * subscribed to its type, in no particular order.  The subscriber
+ * owns the subscription record, which lets it unsubscribe in
+ * constant time; an ear wanting several types needs several records.
+ * Subscribing and unsubscribing during a publish is allowed; new
+ * subscribers won't hear the message being published. */
+struct msg_subscription {
+    struct ear *ear;            /* NULL when not subscribed */
+    msg_type type;
+    size_t index;
+};
+extern void msg_subscribe(struct msg_subscription *, struct ear *, msg_type);
+extern void msg_unsubscribe(struct msg_subscription *);
+extern void msg_publish(struct msg *);
+extern size_t msg_subscriber_count(msg_type);
+/* Drops every subscription. */
+extern void msg_bus_destroy(void);
+/* Saves who is subscribed to what; the subscriptions themselves must
+ * be restored by whoever owns them. */
+extern const struct snapshot_hook msg_bus_snapshot_hook;
+
+/* Tracing, with MSG_TRACE defined: every message told to an ear is
+ * recorded, with the frame, receiver, handler, result and time taken,
+ * in a ring of the most recent MSG_TRACE_RING_SIZE, and counted per
+ * type per frame.  msg_trace_next_frame marks the end of a frame.
+ * The summary describes the last full frame. */
+#ifdef MSG_TRACE
+enum { MSG_TRACE_RING_SIZE = 4096 };
+extern void msg_trace_next_frame(void);
+extern bool msg_trace_dump(const char *path);
+/* Also dump to path if we abort, say on a failed ENSURE. */
+extern void msg_trace_dump_on_abort(const char *path);
+extern void msg_trace_summary(char *buf, size_t size);
+#else
+#define msg_trace_next_frame() ((void)0)
+#endif
@@ -3,4 +3,6 @@
 #include "msg.h"
 
 #define TELL(E, M) (ear_tell((struct ear *)(E), (struct msg *)(M)))
-#define XITION(H) (me->base.handler = (msg_handler)(H), STATE_TRANSITION)
+#define POST(E, M) (ear_post((struct ear *)(E), (struct msg *)(M), sizeof (*(M))))
+#define XITION(H) (me->base.handler = (msg_handler)(H), me->base.state = NULL, STATE_TRANSITION)
+#define XITION_STATE(S) (me->base.handler = (S)->handler, me->base.state = (S), STATE_TRANSITION)
@@ -6,10 +6,14 @@
 #include "main.h"
 #include "text.h"
 #include "ensure.h"
+#include "msg.h"
 
 static struct font font;
 static double accumulated_time = 0.;
 static char fps_output[6] = {0};
+#ifdef MSG_TRACE
+static char msg_trace_output[64] = {0};
+#endif
 
 
 void osd_init(void)
@@ -37,6 +41,9 @@ void osd_draw(void)
     // determine font metrics for placement of ready, fps messages
     complex float fps_output_pos = (viewport_w - 60.f)  + (viewport_h - 30.f)*I;
     text_render_line(&font, fps_output_pos, 0xff000080, fps_output);
+#ifdef MSG_TRACE
+    text_render_line(&font, 10.f + (viewport_h - 30.f)*I, 0xff000080, msg_trace_output);
+#endif
 }
 
 void osd_update(float elapsed_time)
@@ -47,5 +54,8 @@ void osd_update(float elapsed_time)
     if (accumulated_time - last_fps_update >= 1.) {
         snprintf(fps_output, sizeof (fps_output), "%.1f", 1./average_frame_time);
         last_fps_update = accumulated_time;
+#ifdef MSG_TRACE
+        msg_trace_summary(msg_trace_output, sizeof (msg_trace_output));
+#endif
     }
 }
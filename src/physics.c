@@ -19,6 +19,21 @@ void bodies_destroy(void)
     bodies = NULL;
 }
 
+void bodies_snapshot_regions(snapshot_region_fn fn)
+{
+    alloc_bitmap_regions(bodies, fn);
+}
+
+struct body *bodies_slots(void)
+{
+    return alloc_bitmap_members(bodies);
+}
+
+size_t bodies_capacity(void)
+{
+    return alloc_bitmap_capacity(bodies);
+}
+
 struct body *body_new(position p, float collision_radius)
 {
     struct body *b = (struct body *)alloc_bitmap_alloc_first_free(bodies);
@@ -28,6 +43,16 @@ struct body *body_new(position p, float collision_radius)
     return b;
 }
 
+bool bodies_new(size_t n, const position *ps, float collision_radius, struct body **out)
+{
+    if (!alloc_bitmap_alloc_n(bodies, n, (void **)out)) return false;
+    for (size_t i = 0; i < n; ++i)
+        *out[i] = (struct body){.p = ps[i],
+                                .collision_radius = collision_radius,
+                                .mass = 1.};
+    return true;
+}
+
 void body_destroy(struct body *body)
 {
     alloc_bitmap_remove(bodies, body);
@@ -82,7 +107,8 @@ static void check_collisions(void)
     struct alloc_bitmap_iterator iter = alloc_bitmap_iterate(bodies);
     struct body *b;
     while((b = iter.next(&iter))) {
-        if (b->flags & COLLIDES_NEVER || NULL == b->ear)
+        if (b->flags & COLLIDES_NEVER || NULL == b->ear ||
+            NULL == b->ear->handler || !ear_hears(b->ear, MSG_COLLISION))
             continue;
         check_collisions_against(b);
     }
@@ -98,14 +124,12 @@ void bodies_update(float dt)
     check_collisions();
 }
 
-#ifdef DEBUG
 void bodies_foreach(void (*fn)(struct body *))
 {
     struct alloc_bitmap_iterator iter = alloc_bitmap_iterate(bodies);
     struct body *b;
     while((b = iter.next(&iter))) (*fn)(b);
 }
-#endif
 
 #ifdef UNIT_TEST_PHYSICS
 #include "libtap/tap.h"
@@ -240,6 +264,22 @@ static void test_collides_never(void)
 }
 
 
+static void test_bodies_new(void)
+{
+    note("Test bulk body creation");
+    enum { N = 32 };
+    bodies_init(N);
+    position ps[N+1];
+    struct body *bs[N+1];
+    for (int i = 0; i <= N; ++i) ps[i] = i + I*i;
+    ok(!bodies_new(N+1, ps, 1., bs), "No partial batches");
+    bool placed = bodies_new(N, ps, 2., bs);
+    for (int i = 0; i < N; ++i)
+        placed &= bs[i]->p == ps[i] && 2. == bs[i]->collision_radius && 1. == bs[i]->mass;
+    ok(placed, "Bodies are placed in order");
+    bodies_destroy();
+}
+
 static void test_offside(void)
 {
     bodies_init(2);
@@ -285,7 +325,7 @@ static void test_collision_flags(void)
 
 int main(void)
 {
-    plan(14);
+    plan(16);
     long seed = time(NULL);
     note("srand48(%ld)\n", seed);
     srand48(seed);
@@ -293,6 +333,7 @@ int main(void)
     test_specific_collision_regression_2();
     test_simple_collision_occurs();
     test_collision_flags();
+    test_bodies_new();
     lives_ok({simple_test(1000, 100);});
     done_testing();
 }
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include "geometry.h"
 #include "msg.h"
+#include "snapshot.h"
 
 enum collision_flags {
     COLLIDES_NEVER          = 1, // if set, all collision is bypassed
@@ -27,9 +29,14 @@ struct collision_msg {  /* MSG_COLLISION */
 extern void bodies_init(size_t n);
 extern void bodies_destroy(void);
 extern void bodies_update(float dt);
-#ifdef DEBUG
+extern void bodies_snapshot_regions(snapshot_region_fn fn);
+/* The body pool doubles as the entity table (see entity.h): these are
+ * all its slots, live or not. */
+extern struct body *bodies_slots(void);
+extern size_t bodies_capacity(void);
 extern void bodies_foreach(void (*fn)(struct body *));
-#endif
 
 extern struct body *body_new(position p, float collision_radius);
+/* All n bodies or none; out receives them in the order of ps. */
+extern bool bodies_new(size_t n, const position *ps, float collision_radius, struct body **out);
 extern void body_destroy(struct body *body);
@@ -14,11 +14,12 @@ static enum handler_return player_initial(struct actor *me, struct msg *e)
 {
     switch (e->type) {
     case MSG_ENTER:
+        me->base.interests = MSG_INTEREST(MSG_TICK) | MSG_INTEREST(MSG_DAMAGE);
         me->body->affiliation = AFFILIATION_PLAYER;
-        me->sprite.x = 0;
-        me->sprite.y = 0;
-        me->sprite.w = 29;
-        me->sprite.h = 51;
+        actor_sprite(me)->x = 0;
+        actor_sprite(me)->y = 0;
+        actor_sprite(me)->w = 29;
+        actor_sprite(me)->h = 51;
         return STATE_HANDLED;
     case MSG_TICK:
         if (inputs[IN_UP])
@@ -35,6 +36,11 @@ static enum handler_return player_initial(struct actor *me, struct msg *e)
         }
 
         return STATE_HANDLED;
+    case MSG_DAMAGE: {
+        struct msg down = { .type = MSG_PLAYER_DOWN };
+        msg_publish(&down);
+        return XITION(NULL);
+    }
     case MSG_OFFSIDE:
     case MSG_COLLISION:
     default:
@@ -1,160 +1,588 @@
+
 #include <stddef.h>
+#include <stdint.h>
 #include <math.h>
 
 #include "projectile.h"
 #include "ensure.h"
 #include "game_constants.h"
 #include "point_sprite.h"
-#include "ensure.h"
-#include "inline_math.h"
 #include "physics.h"
+#include "video.h"
 #include "msg_macros.h"
 
-static struct texture atlas;
-static struct point_sprite sprites[PROJECTILE_LAST] = {
-    { .atlas = &atlas, .x = 0, .y = 0, .size = 16 }
-};
-struct t {
-    struct ear base;
-    bool is_alive;
-    struct body *body;
+/* Speeds are in pixels per second. */
+const struct projectile_archetype projectile_archetypes[PROJECTILE_LAST] = {
+    [PROJECTILE_BULLET] = {
+        .atlas_path = "data/projectiles.png", .x = 0, .y = 0, .size = 16,
+        .speed = 500., .collision_radius = 4., .damage = 1,
+        .affiliation = AFFILIATION_PLAYER
+    },
+    [PROJECTILE_PELLET] = {
+        .atlas_path = "data/projectiles.png", .x = 16, .y = 0, .size = 8,
+        .speed = 250., .collision_radius = 3., .damage = 1,
+        .affiliation = AFFILIATION_ENEMY
+    },
+    [PROJECTILE_ORB] = {
+        .atlas_path = "data/projectiles.png", .x = 32, .y = 0, .size = 24,
+        .speed = 120., .collision_radius = 10., .damage = 2,
+        .affiliation = AFFILIATION_ENEMY
+    },
+    [PROJECTILE_MISSILE] = {
+        .atlas_path = "data/projectiles.png", .x = 56, .y = 0, .size = 16,
+        .speed = 300., .collision_radius = 4., .damage = 2,
+        .affiliation = AFFILIATION_PLAYER, .turn_rate = 4.
+    }
 };
-static size_t ring_size, producer_i, consumer_i;
-static struct t *projectiles;
-static position *pos_batch;
+static struct point_sprite sprites[PROJECTILE_LAST];
+/* Bullets past the edge of the viewport by more than this are gone
+ * for good, as are any that have been flying too long. */
+static const float CULL_MARGIN = 32., MAX_LIFETIME = 10.;
+
+/* Projectiles are far too many to be bodies: they live in parallel
+ * arrays, and move analytically from where they were fired rather
+ * than being integrated.  The first n_live of each array are all
+ * live; the dead are compacted out at the end of every update. */
+static size_t capacity, n_live;
+static position *origins, *velocities, *ps;
+static float *ages;
+static uint8_t *types, *affiliations, *curves;
+static bool *is_alive;
+/* projectiles_draw's buckets, one per type, each big enough for
+ * everything */
+static position *buckets[PROJECTILE_LAST];
+/* Speed curves are sampled once, when made, as the distance covered
+ * by each age -- measured in seconds' worth of full speed -- so each
+ * projectile costs a lookup.  They only ever accumulate, so snapshots
+ * needn't cover them. */
+enum { TRAVEL_SAMPLES = 32, STEPS_PER_SAMPLE = 8 };
+static struct speed_curve speed_curves[PROJECTILE_MAX_SPEED_CURVES];
+static float travel_times[PROJECTILE_MAX_SPEED_CURVES][TRAVEL_SAMPLES+1];
+static unsigned n_speed_curves;
+/* Scratch for projectiles_update: whatever they could hit, and for
+ * each homing projectile, the way to its nearest target. */
+static struct body **targets;
+static size_t n_targets, targets_capacity;
+static size_t *homing;
+static float *nearest_dx, *nearest_dy, *nearest_d2;
 
 
 void projectiles_init(size_t n)
 {
     point_sprite_init();
-    ENSURE(texture_from_png(&atlas, "data/projectiles.png"));
-    ring_size = closest_power_of_2(n);
-    ENSURE(projectiles = calloc(ring_size, sizeof (*projectiles)));
-    ENSURE(pos_batch = calloc(ring_size, sizeof (*pos_batch)));
-    producer_i = consumer_i = 0;
+    for (int t = 0; t < PROJECTILE_LAST; ++t) {
+        const struct projectile_archetype *arch = &projectile_archetypes[t];
+        sprites[t] = (struct point_sprite){ .x = arch->x, .y = arch->y, .size = arch->size };
+        ENSURE(sprites[t].atlas = texture_cache_acquire(arch->atlas_path));
+    }
+    capacity = n;
+    ENSURE(origins = calloc(capacity, sizeof (*origins)));
+    ENSURE(velocities = calloc(capacity, sizeof (*velocities)));
+    ENSURE(ps = calloc(capacity, sizeof (*ps)));
+    ENSURE(ages = calloc(capacity, sizeof (*ages)));
+    ENSURE(types = calloc(capacity, sizeof (*types)));
+    ENSURE(affiliations = calloc(capacity, sizeof (*affiliations)));
+    ENSURE(curves = calloc(capacity, sizeof (*curves)));
+    ENSURE(is_alive = calloc(capacity, sizeof (*is_alive)));
+    for (int t = 0; t < PROJECTILE_LAST; ++t)
+        ENSURE(buckets[t] = calloc(capacity, sizeof (*buckets[t])));
+    ENSURE(homing = calloc(capacity, sizeof (*homing)));
+    ENSURE(nearest_dx = calloc(capacity, sizeof (*nearest_dx)));
+    ENSURE(nearest_dy = calloc(capacity, sizeof (*nearest_dy)));
+    ENSURE(nearest_d2 = calloc(capacity, sizeof (*nearest_d2)));
+    n_live = 0;
+    n_speed_curves = PROJECTILE_CONSTANT_SPEED + 1;
 }
 
 void projectiles_destroy(void)
 {
-    free(projectiles);
-    projectiles = NULL;
-    ring_size = producer_i = consumer_i = 0;
-    texture_destroy(&atlas);
+    free(origins);
+    free(velocities);
+    free(ps);
+    free(ages);
+    free(types);
+    free(affiliations);
+    free(curves);
+    free(is_alive);
+    for (int t = 0; t < PROJECTILE_LAST; ++t) {
+        free(buckets[t]);
+        buckets[t] = NULL;
+    }
+    free(targets);
+    free(homing);
+    free(nearest_dx);
+    free(nearest_dy);
+    free(nearest_d2);
+    homing = NULL;
+    nearest_dx = nearest_dy = nearest_d2 = NULL;
+    origins = velocities = ps = NULL;
+    ages = NULL;
+    types = affiliations = curves = NULL;
+    is_alive = NULL;
+    targets = NULL;
+    n_targets = targets_capacity = 0;
+    capacity = n_live = 0;
+    n_speed_curves = 0;
+    for (int t = 0; t < PROJECTILE_LAST; ++t) {
+        texture_cache_release(sprites[t].atlas);
+        sprites[t].atlas = NULL;
+    }
 }
 
-static size_t projectiles_count(void)
+void projectiles_snapshot_regions(snapshot_region_fn fn)
 {
-    return ((consumer_i < producer_i) ? consumer_i + ring_size : consumer_i) - producer_i;
+    fn(origins, capacity * sizeof (*origins));
+    fn(velocities, capacity * sizeof (*velocities));
+    fn(ps, capacity * sizeof (*ps));
+    fn(ages, capacity * sizeof (*ages));
+    fn(types, capacity * sizeof (*types));
+    fn(affiliations, capacity * sizeof (*affiliations));
+    fn(curves, capacity * sizeof (*curves));
+    fn(&n_live, sizeof (n_live));
 }
 
-static inline size_t succ(size_t i) { return (i+1) & (ring_size-1); }
+size_t projectiles_count(void)
+{
+    return n_live;
+}
 
-void projectiles_draw(void)
+static inline float travel_time(uint8_t c, float age)
 {
-    size_t j = 0;
-    for (size_t i = consumer_i; i != producer_i; i = succ(i))
-        if (projectiles[i].is_alive)
-            pos_batch[j++] = projectiles[i].body->p;
-        else {
-            if (projectiles[i].body)
-                body_destroy(projectiles[i].body);
-            projectiles[i].body = 0;
-            if (consumer_i == i) consumer_i = succ(consumer_i);
+    if (PROJECTILE_CONSTANT_SPEED == c) return age;
+    float duration = speed_curves[c].duration;
+    if (age >= duration) return travel_times[c][TRAVEL_SAMPLES] + age - duration;
+    float x = age / duration * TRAVEL_SAMPLES, f = x - (unsigned)x;
+    return (1.f-f) * travel_times[c][(unsigned)x] + f * travel_times[c][(unsigned)x + 1];
+}
+
+uint8_t projectile_speed_curve(struct speed_curve c)
+{
+    ENSURE(c.duration > 0. && c.easing);
+    for (unsigned i = PROJECTILE_CONSTANT_SPEED + 1; i < n_speed_curves; ++i)
+        if (speed_curves[i].initial == c.initial && speed_curves[i].duration == c.duration &&
+            speed_curves[i].easing == c.easing)
+            return i;
+    ENSURE(n_speed_curves < PROJECTILE_MAX_SPEED_CURVES);
+    unsigned i = n_speed_curves++;
+    speed_curves[i] = c;
+
+    /* trapezoids, a few to each sample */
+    float *t = travel_times[i], dt = c.duration / (TRAVEL_SAMPLES * STEPS_PER_SAMPLE),
+          last = c.initial;
+    t[0] = 0.;
+    for (unsigned j = 0; j < TRAVEL_SAMPLES; ++j) {
+        t[j+1] = t[j];
+        for (unsigned k = 1; k <= STEPS_PER_SAMPLE; ++k) {
+            float v = ease_float(c.initial, 1., (j * STEPS_PER_SAMPLE + k) * dt, c.duration, c.easing);
+            t[j+1] += (last + v) / 2.f * dt;
+            last = v;
         }
-    if (j == 0) return;
-    point_sprite_draw_batch(&sprites[0], j, pos_batch);
+    }
+    return i;
 }
 
-static enum handler_return handler(struct t *me, struct msg *m)
+static void move_and_cull(float elapsed_time)
 {
-    switch(m->type) {
-    case MSG_COLLISION: {
-        struct collision_msg *cm = (struct collision_msg *)m;
-        struct damage_msg dm = { .base.type = MSG_DAMAGE, .amount = 1 };
-        TELL(cm->them->ear, &dm);
-        me->is_alive = false;
-        return STATE_HANDLED;
+    const float x0 = -CULL_MARGIN, x1 = viewport_w + CULL_MARGIN,
+                y0 = -CULL_MARGIN, y1 = viewport_h + CULL_MARGIN;
+    for (size_t i = 0; i < n_live; ++i) {
+        ages[i] += elapsed_time;
+        position p = origins[i] + velocities[i] * travel_time(curves[i], ages[i]);
+        ps[i] = p;
+        float x = crealf(p), y = cimagf(p);
+        is_alive[i] = (x >= x0) & (x <= x1) & (y >= y0) & (y <= y1) & (ages[i] < MAX_LIFETIME);
     }
-    case MSG_OFFSIDE:
-        /* we probably already died in the collision, but just in case */
-        me->is_alive = false;
-        return STATE_HANDLED;
-    default:
-        return STATE_IGNORED;
+}
+
+/* Anything that can take damage, besides the border and its like. */
+static void gather_target(struct body *b)
+{
+    if (NULL == b->ear || NULL == b->ear->handler ||
+        b->flags & (COLLIDES_NEVER | COLLIDES_INVERSE) ||
+        !ear_hears(b->ear, MSG_DAMAGE))
+        return;
+    if (n_targets == targets_capacity) {
+        targets_capacity = targets_capacity ? 2*targets_capacity : 64;
+        ENSURE(targets = realloc(targets, targets_capacity * sizeof (*targets)));
     }
+    targets[n_targets++] = b;
 }
 
-static void reap(void)
+/* There are only ever a few targets against thousands of
+ * projectiles, so each target sweeps the projectiles rather than the
+ * other way around; projectiles never hit their own side. */
+static void hit_target(struct body *t)
 {
-    while (producer_i != consumer_i && !projectiles[consumer_i].is_alive) {
-        body_destroy(projectiles[consumer_i].body);
-        consumer_i = succ(consumer_i);
+    float tx = crealf(t->p), ty = cimagf(t->p);
+    uint8_t side = t->affiliation;
+    for (size_t i = 0; i < n_live; ++i) {
+        float dx = crealf(ps[i]) - tx, dy = cimagf(ps[i]) - ty,
+              r = t->collision_radius + projectile_archetypes[types[i]].collision_radius;
+        if (!(is_alive[i] & (affiliations[i] != side) & (dx*dx + dy*dy < r*r)))
+            continue;
+        struct damage_msg dm = { .base.type = MSG_DAMAGE,
+                                 .amount = projectile_archetypes[types[i]].damage };
+        POST(t->ear, &dm);
+        is_alive[i] = false;
     }
 }
 
+/* Homing projectiles turn towards the nearest target not on their
+ * side, no faster than their type's turn rate.  Each target is tested
+ * against all of them at once, and all of them steered at once, so
+ * the loops run across the projectiles rather than down them. */
+static void steer(float elapsed_time)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < n_live; ++i)
+        if (projectile_archetypes[types[i]].turn_rate > 0.f)
+            homing[n++] = i;
+    if (0 == n || 0 == n_targets) return;
+
+    for (size_t k = 0; k < n; ++k)
+        nearest_d2[k] = INFINITY;
+    for (size_t t = 0; t < n_targets; ++t) {
+        float tx = crealf(targets[t]->p), ty = cimagf(targets[t]->p);
+        uint8_t side = targets[t]->affiliation;
+        for (size_t k = 0; k < n; ++k) {
+            size_t i = homing[k];
+            float dx = tx - crealf(ps[i]), dy = ty - cimagf(ps[i]), d2 = dx*dx + dy*dy;
+            bool is_nearer = (affiliations[i] != side) & (d2 < nearest_d2[k]);
+            nearest_d2[k] = is_nearer ? d2 : nearest_d2[k];
+            nearest_dx[k] = is_nearer ? dx : nearest_dx[k];
+            nearest_dy[k] = is_nearer ? dy : nearest_dy[k];
+        }
+    }
+
+    float turn_cos[PROJECTILE_LAST], turn_sin[PROJECTILE_LAST];
+    for (int t = 0; t < PROJECTILE_LAST; ++t) {
+        turn_cos[t] = cosf(projectile_archetypes[t].turn_rate * elapsed_time);
+        turn_sin[t] = sinf(projectile_archetypes[t].turn_rate * elapsed_time);
+    }
+    for (size_t k = 0; k < n; ++k) {
+        size_t i = homing[k];
+        float vx = crealf(velocities[i]), vy = cimagf(velocities[i]),
+              dx = nearest_dx[k], dy = nearest_dy[k],
+              speed = sqrtf(vx*vx + vy*vy), distance = sqrtf(nearest_d2[k]),
+              c = turn_cos[types[i]], s = vx*dy - vy*dx < 0.f ? -turn_sin[types[i]] : turn_sin[types[i]];
+        /* within a turn of the target: straight at it; else turn */
+        bool has_target = distance > 0.f && distance < INFINITY,
+             is_within = vx*dx + vy*dy >= c * speed * distance;
+        float nx = is_within ? dx * speed / distance : vx*c - vy*s,
+              ny = is_within ? dy * speed / distance : vx*s + vy*c;
+        nx = has_target ? nx : vx;
+        ny = has_target ? ny : vy;
+        /* and set off anew from where it is */
+        velocities[i] = nx + I*ny;
+        origins[i] = ps[i] - velocities[i] * travel_time(curves[i], ages[i]);
+    }
+}
+
+/* Keeps the survivors in order, so drawing order doesn't shuffle. */
+static void compact(void)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < n_live; ++i) {
+        if (!is_alive[i]) continue;
+        if (i != j) {
+            origins[j] = origins[i];
+            velocities[j] = velocities[i];
+            ps[j] = ps[i];
+            ages[j] = ages[i];
+            types[j] = types[i];
+            affiliations[j] = affiliations[i];
+            curves[j] = curves[i];
+            is_alive[j] = true;
+        }
+        ++j;
+    }
+    n_live = j;
+}
+
+void projectiles_update(float elapsed_time)
+{
+    move_and_cull(elapsed_time);
+    n_targets = 0;
+    bodies_foreach(gather_target);
+    for (size_t t = 0; t < n_targets; ++t)
+        hit_target(targets[t]);
+    steer(elapsed_time);
+    compact();
+}
+
+/* One pass sorts them into a bucket per type, each of which is then
+ * one draw. */
+void projectiles_draw(void)
+{
+    size_t counts[PROJECTILE_LAST] = {0};
+    for (size_t i = 0; i < n_live; ++i) {
+        uint8_t t = types[i];
+        buckets[t][counts[t]++] = ps[i];
+    }
+    for (int t = 0; t < PROJECTILE_LAST; ++t)
+        if (counts[t])
+            point_sprite_draw_batch(&sprites[t], counts[t], buckets[t]);
+}
+
+size_t projectiles_fire(position origin, size_t n, const position *vs,
+                        uint8_t speed_curve, enum projectile_type type,
+                        unsigned affiliation)
+{
+    ENSURE(type < PROJECTILE_LAST && speed_curve < n_speed_curves);
+    if (PROJECTILE_DEFAULT_AFFILIATION == affiliation)
+        affiliation = projectile_archetypes[type].affiliation;
+    if (n > capacity - n_live)
+        n = capacity - n_live;
+    for (size_t k = 0, i = n_live; k < n; ++k, ++i) {
+        origins[i] = ps[i] = origin;
+        velocities[i] = vs[k];
+        ages[i] = 0.;
+        types[i] = type;
+        affiliations[i] = affiliation;
+        curves[i] = speed_curve;
+        is_alive[i] = true;
+    }
+    n_live += n;
+    return n;
+}
+
 bool projectile_shoot_at(position origin, position target,
                          enum projectile_type type,
                          unsigned affiliation)
 {
-    reap();
-    struct t *this = &projectiles[producer_i];
-    producer_i = succ(producer_i);
-    if (producer_i == consumer_i && projectiles[consumer_i].is_alive) {
-        body_destroy(projectiles[consumer_i].body);
-        consumer_i = succ(consumer_i);
-    }
-    ENSURE(producer_i != consumer_i);
-
-    this->body = body_new(origin, sprites[0].size);
-    ENSURE(this->body);
-    this->body->affiliation = affiliation;
-    this->body->flags = COLLIDES_BY_AFFILIATION;
-    this->base.handler = handler;
-    this->body->ear = &this->base;
-    position adjusted = target-origin;
-    float theta = atan2f(cimagf(adjusted), crealf(adjusted));
-    float speed = 42.;
-    this->body->F = speed*cosf(theta) + I*speed*sinf(theta);
-    this->is_alive = true;
-    return true;
+    ENSURE(type < PROJECTILE_LAST);
+    position v = projectile_archetypes[type].speed * cexpf(I * cargf(target - origin));
+    return 1 == projectiles_fire(origin, 1, &v, PROJECTILE_CONSTANT_SPEED, type, affiliation);
 }
 
 #ifdef UNIT_TEST_PROJECTILE
 #include "libtap/tap.h"
-#include "video.h"
 #include "camera.h"
-#include "physics.h"
 
 static void projectile_fire_offside_verify_culled(void)
 {
+    note("Test that projectiles leaving the screen are culled");
     bodies_init(2);
     projectiles_init(1);
 
-    float screen_radius = 10. + sqrtf(powf(viewport_w/2, 2)+powf(viewport_h/2,2));
-    struct body *border = body_new(viewport_w/2. + I*(viewport_h/2.), screen_radius);
-    ok(NULL != border);
-    border->flags |= COLLIDES_INVERSE;
-
     projectile_shoot_at(viewport_w/2 + I*(viewport_h/2), 0., PROJECTILE_BULLET, AFFILIATION_PLAYER);
+    cmp_ok(projectiles_count(), "==", 1);
     int n;
     for (n = 100; projectiles_count() > 0 && n > 0; --n)
-        bodies_update(1.);
+        projectiles_update(1/60.);
     cmp_ok(n, ">", 0);
     projectiles_destroy();
     bodies_destroy();
 }
 
+struct target {
+    struct ear base;
+    int damage;
+};
+
+static enum handler_return target_handler(struct target *me, struct msg *m)
+{
+    if (MSG_DAMAGE != m->type) return STATE_IGNORED;
+    me->damage += ((struct damage_msg *)m)->amount;
+    return STATE_HANDLED;
+}
+
+static void projectile_hits_only_the_other_side(void)
+{
+    note("Test that projectiles hit targets of other affiliations");
+    bodies_init(4);
+    projectiles_init(16);
+    msg_queue_init(256);
+
+    struct target enemy = { .base.handler = (msg_handler)target_handler },
+                  player = { .base.handler = (msg_handler)target_handler };
+    struct body *eb = body_new(100. + 100.*I, 10.), *pb = body_new(300. + 100.*I, 10.);
+    eb->ear = &enemy.base;
+    eb->affiliation = AFFILIATION_ENEMY;
+    pb->ear = &player.base;
+    pb->affiliation = AFFILIATION_PLAYER;
+
+    /* both from between them, one towards each */
+    projectile_shoot_at(200. + 100.*I, 100. + 100.*I, PROJECTILE_BULLET, AFFILIATION_PLAYER);
+    projectile_shoot_at(200. + 100.*I, 300. + 100.*I, PROJECTILE_BULLET, AFFILIATION_PLAYER);
+    for (int i = 0; i < 120; ++i) {
+        projectiles_update(1/60.);
+        msg_dispatch_pending();
+    }
+    ok(1 == enemy.damage && 0 == player.damage);
+    cmp_ok(projectiles_count(), "==", 0, "and are spent hitting them, or culled missing them");
+
+    msg_queue_destroy();
+    projectiles_destroy();
+    bodies_destroy();
+}
+
+static void projectile_types(void)
+{
+    note("Test that projectiles do what their type says");
+    bodies_init(4);
+    projectiles_init(16);
+    msg_queue_init(256);
+    struct target player = { .base.handler = (msg_handler)target_handler };
+    struct body *pb = body_new(300. + 100.*I, 10.);
+    pb->ear = &player.base;
+    pb->affiliation = AFFILIATION_PLAYER;
+
+    projectile_shoot_at(100. + 100.*I, pb->p, PROJECTILE_ORB, PROJECTILE_DEFAULT_AFFILIATION);
+    projectile_shoot_at(100. + 100.*I, pb->p, PROJECTILE_BULLET, PROJECTILE_DEFAULT_AFFILIATION);
+    projectile_shoot_at(200. + 200.*I, 0., PROJECTILE_PELLET, AFFILIATION_ENEMY);
+    lives_ok({projectiles_draw();}, "Mixed types draw");
+    for (int i = 0; i < 180; ++i) {
+        projectiles_update(1/60.);
+        msg_dispatch_pending();
+    }
+    cmp_ok(player.damage, "==", projectile_archetypes[PROJECTILE_ORB].damage,
+           "Orbs hit the player, the player's own bullets don't");
+
+    msg_queue_destroy();
+    projectiles_destroy();
+    bodies_destroy();
+}
+
+static void projectile_homing(void)
+{
+    note("Test that missiles home in on the other side");
+    bodies_init(4);
+    projectiles_init(16);
+    msg_queue_init(256);
+    struct target enemy = { .base.handler = (msg_handler)target_handler },
+                  player = { .base.handler = (msg_handler)target_handler };
+    struct body *eb = body_new(500. + 100.*I, 10.), *pb = body_new(320. + 200.*I, 10.);
+    eb->ear = &enemy.base;
+    eb->affiliation = AFFILIATION_ENEMY;
+    pb->ear = &player.base;
+    pb->affiliation = AFFILIATION_PLAYER;
+
+    /* fired away from the enemy, past the player */
+    projectile_shoot_at(320. + 300.*I, 100. + 300.*I, PROJECTILE_MISSILE, PROJECTILE_DEFAULT_AFFILIATION);
+    projectile_shoot_at(320. + 300.*I, 320. + 479.*I, PROJECTILE_MISSILE, PROJECTILE_DEFAULT_AFFILIATION);
+    for (int i = 0; i < 180 && projectiles_count(); ++i) {
+        projectiles_update(1/60.);
+        msg_dispatch_pending();
+    }
+    ok(2*projectile_archetypes[PROJECTILE_MISSILE].damage == enemy.damage && 0 == player.damage,
+       "They turn round to hit the enemy, not their own");
+
+    msg_queue_destroy();
+    projectiles_destroy();
+    bodies_destroy();
+}
+
+static void projectile_slots_are_reused(void)
+{
+    note("Test that only live projectiles take up room");
+    bodies_init(2);
+    projectiles_init(8);
+    position centre = 320. + 240.*I;
+    /* one slow and long-lived, then seven that are soon gone */
+    bool all_fired = projectile_shoot_at(centre, 320., PROJECTILE_ORB, AFFILIATION_ENEMY);
+    for (int i = 0; i < 7; ++i)
+        all_fired &= projectile_shoot_at(centre, 0., PROJECTILE_BULLET, AFFILIATION_ENEMY);
+    ok(all_fired && !projectile_shoot_at(centre, 0., PROJECTILE_BULLET, AFFILIATION_ENEMY),
+       "Firing when full fails, rather than evicting anyone");
+    for (int i = 0; i < 60; ++i)
+        projectiles_update(1/60.);
+    cmp_ok(projectiles_count(), "==", 1);
+    all_fired = true;
+    for (int i = 0; i < 7; ++i)
+        all_fired &= projectile_shoot_at(centre, 0., PROJECTILE_BULLET, AFFILIATION_ENEMY);
+    ok(all_fired && 8 == projectiles_count(), "The dead make room at once, whoever's oldest");
+    projectiles_destroy();
+    bodies_destroy();
+}
+
+static void projectile_speed_curves(void)
+{
+    note("Test projectiles easing up to speed");
+    bodies_init(2);
+    projectiles_init(8);
+    struct speed_curve ramp = { .initial = 0., .duration = 1., .easing = easing_linear };
+    uint8_t c = projectile_speed_curve(ramp);
+    ok(c != PROJECTILE_CONSTANT_SPEED && c == projectile_speed_curve(ramp), "Curves are shared");
+    /* from rest, linearly up to full speed over a second */
+    ok(fabsf(travel_time(c, .5) - .125f) < .001 && fabsf(travel_time(c, 1.) - .5f) < .001 &&
+       fabsf(travel_time(c, 2.) - 1.5f) < .001);
+    position v = 100.;
+    projectiles_fire(100. + 100.*I, 1, &v, c, PROJECTILE_BULLET, AFFILIATION_ENEMY);
+    for (int i = 0; i < 60; ++i)
+        projectiles_update(1/60.);
+    ok(fabsf(crealf(ps[0]) - 150.f) < 1.);
+    projectiles_destroy();
+    bodies_destroy();
+}
+
 int main(void)
 {
     video_init();
     camera_init();
-    plan(2);
-    todo();
+    plan(13);
     projectile_fire_offside_verify_culled();
-    // create projectile and verify it gets culled when offside
-    // create projectile and verify it collides with something else (verify collision modes)
-    // verify pointsprite drawing
-    end_todo;
+    projectile_hits_only_the_other_side();
+    projectile_types();
+    projectile_slots_are_reused();
+    projectile_homing();
+    projectile_speed_curves();
     done_testing();
 }
 #endif
+
+#ifdef PROFILE_PROJECTILE
+#include <stdio.h>
+#include <time.h>
+#include "camera.h"
+
+static enum handler_return ignore_damage(struct ear *me __attribute__((unused)),
+                                         struct msg *m __attribute__((unused)))
+{
+    return STATE_HANDLED;
+}
+
+/* A screenful of bullets spraying from the middle, against a handful
+ * of targets; one in every homing_every homes in on them, if it
+ * isn't 0. */
+static double ms_per_frame(int homing_every)
+{
+    enum { N = 20000, N_TARGETS = 32, N_FRAMES = 600 };
+    bodies_init(N_TARGETS);
+    projectiles_init(N);
+    msg_queue_init(64*1024);
+    struct ear ear = { .handler = (msg_handler)ignore_damage };
+    for (int i = 0; i < N_TARGETS; ++i) {
+        struct body *b = body_new(20.*i + 20.*I, 10.);
+        b->ear = &ear;
+        b->affiliation = AFFILIATION_ENEMY;
+    }
+    position centre = viewport_w/2 + I*(viewport_h/2);
+
+    clock_t start = clock();
+    for (int frame = 0; frame < N_FRAMES; ++frame) {
+        for (size_t i = projectiles_count(); i < N - 100; ++i) {
+            bool is_homing = homing_every && 0 == i % homing_every;
+            projectile_shoot_at(centre, centre + cexpf(I * (i % 360)),
+                                is_homing ? PROJECTILE_MISSILE : PROJECTILE_PELLET,
+                                is_homing ? AFFILIATION_PLAYER : AFFILIATION_ENEMY);
+        }
+        projectiles_update(1/60.);
+        msg_dispatch_pending();
+    }
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    msg_queue_destroy();
+    projectiles_destroy();
+    bodies_destroy();
+    return 1000. * elapsed / N_FRAMES;
+}
+
+int main(void)
+{
+    video_init();
+    camera_init();
+    printf("20000 projectiles: %.3f ms per frame\n", ms_per_frame(0));
+    printf("with one in ten homing: %.3f ms per frame\n", ms_per_frame(10));
+}
+#endif
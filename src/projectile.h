@@ -2,24 +2,68 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include "geometry.h"
 #include "msg.h"
+#include "easing.h"
 
 enum projectile_type {
-    PROJECTILE_BULLET,
+    PROJECTILE_BULLET,          /* the player's */
+    PROJECTILE_PELLET,          /* small and quick */
+    PROJECTILE_ORB,             /* big and slow */
+    PROJECTILE_MISSILE,         /* homing */
     PROJECTILE_LAST
 };
 
+struct projectile_archetype {
+    const char *atlas_path;
+    uint16_t x, y, size;        /* a square in the atlas */
+    float speed, collision_radius;
+    int damage;
+    unsigned affiliation;       /* unless fired with another */
+    float turn_rate;            /* radians per second, if it homes */
+};
+
+extern const struct projectile_archetype projectile_archetypes[PROJECTILE_LAST];
+
+enum { PROJECTILE_DEFAULT_AFFILIATION = 0xff };
+
 struct damage_msg {
     struct msg base;
     int amount;
 };
 
+/* How a projectile gets up to speed: it starts at initial times its
+ * speed and eases to the full speed over duration seconds. */
+struct speed_curve {
+    float initial, duration;
+    easing_fn easing;
+};
+
+enum { PROJECTILE_CONSTANT_SPEED = 0, PROJECTILE_MAX_SPEED_CURVES = 16 };
+
+/* Room for n live projectiles at once. */
 extern void projectiles_init(size_t n);
 extern void projectiles_destroy(void);
+/* Moves projectiles, culls those that left the screen, damages
+ * anything of another affiliation they hit, and steers the homing
+ * ones. */
+extern void projectiles_update(float elapsed_time);
 extern void projectiles_draw(void);
+extern size_t projectiles_count(void);
+extern void projectiles_snapshot_regions(snapshot_region_fn fn);
 
 extern bool projectile_shoot_at(position origin, position target,
                                 enum projectile_type type,
                                 unsigned affiliation);
+/* Fires n projectiles from origin at once, velocities[i] being the
+ * full speed of the i-th, which moves along the given speed curve.
+ * Either can take PROJECTILE_DEFAULT_AFFILIATION for the type's.
+ * Returns how many there was room for. */
+extern size_t projectiles_fire(position origin, size_t n, const position *velocities,
+                               uint8_t speed_curve, enum projectile_type type,
+                               unsigned affiliation);
+/* Curves are kept, and shared between identical ones, until
+ * projectiles_destroy(); the result is for projectiles_fire. */
+extern uint8_t projectile_speed_curve(struct speed_curve c);
 
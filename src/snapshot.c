@@ -0,0 +1,353 @@
+
+#include <stdint.h>
+#include <string.h>
+
+#include "snapshot.h"
+#include "ensure.h"
+
+struct entry {
+    void *p;
+    size_t size;
+    const struct snapshot_hook *hook;
+};
+
+static struct {
+    struct entry *each;
+    size_t n, capacity;
+    unsigned generation;
+} tracked;
+
+struct t {
+    unsigned generation;
+    size_t size, capacity;
+    uint8_t *bytes;
+};
+
+static void add_entry(struct entry e)
+{
+    if (tracked.n == tracked.capacity) {
+        tracked.capacity = tracked.capacity ? 2 * tracked.capacity : 16;
+        ENSURE(tracked.each = realloc(tracked.each, tracked.capacity * sizeof (*tracked.each)));
+    }
+    tracked.each[tracked.n++] = e;
+    ++tracked.generation;
+}
+
+void snapshot_track(void *p, size_t size)
+{
+    ENSURE(p);
+    add_entry((struct entry){ .p = p, .size = size });
+}
+
+void snapshot_track_hook(const struct snapshot_hook *hook)
+{
+    ENSURE(hook && hook->size && hook->save && hook->restore);
+    add_entry((struct entry){ .hook = hook });
+}
+
+void snapshot_untrack_all(void)
+{
+    free(tracked.each);
+    tracked.each = NULL;
+    tracked.n = tracked.capacity = 0;
+    ++tracked.generation;
+}
+
+static void reserve(struct t *t, size_t size)
+{
+    if (size <= t->capacity) return;
+    ENSURE(t->bytes = realloc(t->bytes, size));
+    t->capacity = size;
+}
+
+snapshot snapshot_take(snapshot reuse)
+{
+    struct t *t = reuse;
+    if (NULL == t) ENSURE(t = calloc(1, sizeof (*t)));
+
+    size_t size = 0, hook_sizes[tracked.n + 1];
+    for (size_t i = 0; i < tracked.n; ++i) {
+        struct entry *e = &tracked.each[i];
+        if (e->hook) {
+            hook_sizes[i] = e->hook->size();
+            size += sizeof (size_t) + hook_sizes[i];
+        } else
+            size += e->size;
+    }
+    reserve(t, size);
+
+    uint8_t *q = t->bytes;
+    for (size_t i = 0; i < tracked.n; ++i) {
+        struct entry *e = &tracked.each[i];
+        if (e->hook) {
+            memcpy(q, &hook_sizes[i], sizeof (size_t));
+            q += sizeof (size_t);
+            e->hook->save(q);
+            q += hook_sizes[i];
+        } else {
+            memcpy(q, e->p, e->size);
+            q += e->size;
+        }
+    }
+    t->size = size;
+    t->generation = tracked.generation;
+    return t;
+}
+
+void snapshot_restore(snapshot t_)
+{
+    struct t *t = t_;
+    ENSURE(t->generation == tracked.generation);
+    const uint8_t *q = t->bytes;
+    for (size_t i = 0; i < tracked.n; ++i) {
+        struct entry *e = &tracked.each[i];
+        if (e->hook) {
+            size_t size;
+            memcpy(&size, q, sizeof (size));
+            q += sizeof (size);
+            e->hook->restore(q, size);
+            q += size;
+        } else {
+            memcpy(e->p, q, e->size);
+            q += e->size;
+        }
+    }
+    ENSURE(q == t->bytes + t->size);
+}
+
+size_t snapshot_size(snapshot t)
+{
+    return ((struct t *)t)->size;
+}
+
+void snapshot_destroy(snapshot t_)
+{
+    struct t *t = t_;
+    free(t->bytes);
+    memset(t, 0, sizeof (*t));
+    free(t);
+}
+
+
+/* A delta is a series of (zero run, literal length, literal bytes),
+ * the lengths as varints; literals only end at a run of at least
+ * MIN_ZERO_RUN zeroes, so that short runs don't cost more than they
+ * save. */
+struct delta {
+    unsigned generation;
+    size_t to_size, size;
+    uint8_t bytes[];
+};
+
+enum { MIN_ZERO_RUN = 8, MAX_VARINT_BYTES = (8 * sizeof (size_t) + 6) / 7 };
+
+static uint8_t *put_varint(uint8_t *q, size_t x)
+{
+    for (; x >= 0x80; x >>= 7)
+        *q++ = 0x80 | (x & 0x7f);
+    *q++ = x;
+    return q;
+}
+
+static const uint8_t *get_varint(const uint8_t *q, size_t *x)
+{
+    *x = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        *x |= (size_t)(*q & 0x7f) << shift;
+        if (!(*q++ & 0x80)) return q;
+    }
+}
+
+static inline uint8_t xor_at(struct t *from, struct t *to, size_t i)
+{
+    return to->bytes[i] ^ (i < from->size ? from->bytes[i] : 0);
+}
+
+snapshot_delta snapshot_diff(snapshot from_, snapshot to_)
+{
+    struct t *from = from_, *to = to_;
+    ENSURE(from->generation == to->generation);
+    size_t n = to->size, common = n < from->size ? n : from->size;
+    size_t bound = n + 2 * MAX_VARINT_BYTES * (n / MIN_ZERO_RUN + 2);
+    struct delta *d;
+    ENSURE(d = malloc(sizeof (*d) + bound));
+
+    uint8_t *q = d->bytes;
+    for (size_t i = 0; i < n;) {
+        size_t zeros_start = i;
+        /* most of a snapshot doesn't change, so skip it a word at a time */
+        while (i + sizeof (uint64_t) <= common &&
+               0 == memcmp(&from->bytes[i], &to->bytes[i], sizeof (uint64_t)))
+            i += sizeof (uint64_t);
+        while (i < n && 0 == xor_at(from, to, i)) ++i;
+
+        size_t start = i, end = i;
+        for (size_t run = 0; i < n && run < MIN_ZERO_RUN; ++i) {
+            if (xor_at(from, to, i)) {
+                run = 0;
+                end = i + 1;
+            } else
+                ++run;
+        }
+        i = end;
+        q = put_varint(q, start - zeros_start);
+        q = put_varint(q, end - start);
+        for (size_t j = start; j < end; ++j)
+            *q++ = xor_at(from, to, j);
+    }
+
+    d->generation = to->generation;
+    d->to_size = n;
+    d->size = q - d->bytes;
+    ENSURE(d->size <= bound);
+    ENSURE(d = realloc(d, sizeof (*d) + d->size));
+    return d;
+}
+
+void snapshot_apply(snapshot from_, snapshot_delta d_)
+{
+    struct t *from = from_;
+    struct delta *d = d_;
+    ENSURE(from->generation == d->generation);
+    if (d->to_size > from->size) {
+        reserve(from, d->to_size);
+        memset(from->bytes + from->size, 0, d->to_size - from->size);
+    }
+    from->size = d->to_size;
+
+    const uint8_t *q = d->bytes, *end = d->bytes + d->size;
+    for (size_t i = 0; q < end;) {
+        size_t zeros, n;
+        q = get_varint(q, &zeros);
+        q = get_varint(q, &n);
+        i += zeros;
+        ENSURE(i + n <= from->size);
+        while (n--)
+            from->bytes[i++] ^= *q++;
+    }
+}
+
+size_t snapshot_delta_size(snapshot_delta d)
+{
+    return sizeof (struct delta) + ((struct delta *)d)->size;
+}
+
+void snapshot_delta_destroy(snapshot_delta d)
+{
+    free(d);
+}
+
+#ifdef UNIT_TEST_SNAPSHOT
+#include "libtap/tap.h"
+
+static void test_regions(void)
+{
+    note("Test that tracked regions, and only those, are restored");
+    int a[100], b[100];
+    for (int i = 0; i < 100; ++i) a[i] = b[i] = i;
+    snapshot_track(a, sizeof (a));
+    snapshot s = snapshot_take(NULL);
+    cmp_ok(snapshot_size(s), "==", sizeof (a));
+    for (int i = 0; i < 100; ++i) a[i] = b[i] = -i;
+    snapshot_restore(s);
+    bool restored = true, untouched = true;
+    for (int i = 0; i < 100; ++i) {
+        restored &= a[i] == i;
+        untouched &= b[i] == -i;
+    }
+    ok(restored && untouched);
+    snapshot_track(b, sizeof (b));
+    dies_ok({snapshot_restore(s);}, "Tracking more invalidates old snapshots");
+    snapshot_destroy(s);
+    snapshot_untrack_all();
+}
+
+/* something that moves when it grows */
+static int *growing;
+static size_t n_growing;
+
+static void grow(int x)
+{
+    ENSURE(growing = realloc(growing, ++n_growing * sizeof (*growing)));
+    growing[n_growing-1] = x;
+}
+
+static size_t growing_size(void) { return n_growing * sizeof (*growing); }
+static void growing_save(void *out) { memcpy(out, growing, growing_size()); }
+static void growing_restore(const void *in, size_t size)
+{
+    n_growing = size / sizeof (*growing);
+    if (0 == size) return;
+    ENSURE(growing = realloc(growing, size));
+    memcpy(growing, in, size);
+}
+
+static const struct snapshot_hook growing_hook = {
+    .size = growing_size, .save = growing_save, .restore = growing_restore
+};
+
+static void test_hooks(void)
+{
+    note("Test state that saves itself");
+    for (int i = 0; i < 3; ++i) grow(i);
+    snapshot_track_hook(&growing_hook);
+    snapshot s = snapshot_take(NULL);
+    for (int i = 3; i < 1000; ++i) grow(i);
+    snapshot_restore(s);
+    ok(3 == n_growing && 0 == growing[0] && 2 == growing[2]);
+    snapshot_destroy(s);
+    snapshot_untrack_all();
+}
+
+static void test_deltas(void)
+{
+    note("Test delta compression between snapshots");
+    enum { N = 64*1024 };
+    static uint8_t world[N];
+    for (int i = 0; i < N; ++i) world[i] = i * 7;
+    snapshot_track(world, sizeof (world));
+    snapshot_track_hook(&growing_hook);
+    snapshot a = snapshot_take(NULL);
+    world[10] ^= 1;
+    world[11] ^= 0xff;
+    world[N/2] = 42;
+    world[N-1] = 0;
+    for (int i = 0; i < 100; ++i) grow(i);
+    snapshot b = snapshot_take(NULL);
+
+    snapshot_delta d = snapshot_diff(a, b);
+    note("%zu byte snapshot, %zu byte delta", snapshot_size(b), snapshot_delta_size(d));
+    ok(snapshot_delta_size(d) < snapshot_size(b) / 50, "Small changes make small deltas");
+    snapshot_apply(a, d);
+    ok(snapshot_size(a) == snapshot_size(b) &&
+       0 == memcmp(((struct t *)a)->bytes, ((struct t *)b)->bytes, snapshot_size(b)),
+       "Applying a delta recreates the later snapshot");
+    snapshot_delta_destroy(d);
+
+    /* and back again, shrinking */
+    memset(world, 0, sizeof (world));
+    n_growing = 0;
+    snapshot c = snapshot_take(NULL);
+    d = snapshot_diff(b, c);
+    snapshot_apply(b, d);
+    snapshot_delta_destroy(d);
+    for (int i = 0; i < 10; ++i) grow(i);
+    snapshot_restore(b);
+    ok(0 == world[N/2] && 0 == n_growing, "including when the state shrinks");
+
+    snapshot_destroy(a);
+    snapshot_destroy(b);
+    snapshot_destroy(c);
+    snapshot_untrack_all();
+    free(growing);
+}
+
+int main(void)
+{
+    plan(7);
+    test_regions();
+    test_hooks();
+    test_deltas();
+    done_testing();
+}
+#endif
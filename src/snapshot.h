@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+/* Snapshots copy every tracked region into one contiguous buffer,
+ * and restore by copying it back in place, so anything tracked must
+ * stay where it is -- fixed pools, not things that get realloc'd.
+ * State that moves or changes size saves itself through a hook
+ * instead, and fixes up its own pointers on restore.
+ *
+ * Tracking anything new invalidates existing snapshots. */
+typedef void (*snapshot_region_fn)(void *p, size_t size);
+
+struct snapshot_hook {
+    size_t (*size)(void);
+    void (*save)(void *out);
+    void (*restore)(const void *in, size_t size);
+};
+
+extern void snapshot_track(void *p, size_t size);
+extern void snapshot_track_hook(const struct snapshot_hook *hook);
+extern void snapshot_untrack_all(void);
+
+typedef void *snapshot;
+/* Reuses the buffer of an old snapshot, if given one. */
+extern snapshot snapshot_take(snapshot reuse);
+extern void snapshot_restore(snapshot);
+extern size_t snapshot_size(snapshot);
+extern void snapshot_destroy(snapshot);
+
+/* Deltas XOR one snapshot against an earlier one and run-length
+ * encode the zeroes, so consecutive frames cost little to keep.
+ * Applying a delta turns from into to, in place. */
+typedef void *snapshot_delta;
+extern snapshot_delta snapshot_diff(snapshot from, snapshot to);
+extern void snapshot_apply(snapshot from, snapshot_delta delta);
+extern size_t snapshot_delta_size(snapshot_delta);
+extern void snapshot_delta_destroy(snapshot_delta);
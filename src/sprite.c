@@ -2,63 +2,157 @@
 #include <GL/glew.h>
 #include <GL/gl.h>
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "ensure.h"
 #include "shader.h"
 #include "camera.h"
 #include "sprite.h"
 
-static const GLchar sprite_vertex_shader_src[] = {
-#include "sprite.vert.i"
+static const GLchar sprite_batch_vertex_shader_src[] = {
+#include "sprite_batch.vert.i"
     , 0 };
-static const GLchar sprite_fragment_shader_src[] = {
-#include "sprite.frag.i"
+static const GLchar sprite_batch_fragment_shader_src[] = {
+#include "sprite_batch.frag.i"
     , 0 };
-static GLuint shader, a_vertices;
+
+/* Each sprite in a batch is a quad of these. */
+struct batch_vertex {
+    GLfloat vertex[2], translation[2], transform[2], clip[2], all_white;
+};
+
+enum { BATCH_MAX_SPRITES = 2048 };  /* keeps indices within 16 bits */
+static GLuint batch_shader, batch_vertices, batch_indices;
+static struct {
+    GLint vertex, translation, transform, clip, all_white;
+    GLint projection, atlas, atlas_size;
+} batch_loc;
+/* What's been pushed since the last flush, all on one atlas. */
+static struct {
+    bool is_open;
+    struct texture *atlas;
+    size_t n;
+    struct batch_vertex vertices[4*BATCH_MAX_SPRITES];
+} batch;
 
 void sprite_init(void)
 {
     texture_init();
-    if (0 == shader)
-        shader = build_shader_program("sprite", sprite_vertex_shader_src, sprite_fragment_shader_src);
-    ENSURE(shader);
-    glGenBuffers(1, &a_vertices);
+    if (0 == batch_shader)
+        batch_shader = build_shader_program("sprite_batch", sprite_batch_vertex_shader_src,
+                                            sprite_batch_fragment_shader_src);
+    ENSURE(batch_shader);
+    batch_loc.vertex = glGetAttribLocation(batch_shader, "a_vertex");
+    batch_loc.translation = glGetAttribLocation(batch_shader, "a_translation");
+    batch_loc.transform = glGetAttribLocation(batch_shader, "a_transform");
+    batch_loc.clip = glGetAttribLocation(batch_shader, "a_clip");
+    batch_loc.all_white = glGetAttribLocation(batch_shader, "a_all_white");
+    batch_loc.projection = glGetUniformLocation(batch_shader, "u_projection");
+    batch_loc.atlas = glGetUniformLocation(batch_shader, "u_atlas");
+    batch_loc.atlas_size = glGetUniformLocation(batch_shader, "u_atlas_size");
+
+    glGenBuffers(1, &batch_vertices);
+    glGenBuffers(1, &batch_indices);
+    /* The quads never change shape, so neither do their indices. */
+    static uint16_t indices[6*BATCH_MAX_SPRITES];
+    for (int i = 0; i < BATCH_MAX_SPRITES; ++i) {
+        static const uint8_t quad[] = { 0,1,2, 2,3,0 };
+        for (int j = 0; j < 6; ++j)
+            indices[6*i+j] = 4*i + quad[j];
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch_indices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof (indices), indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-void sprite_draw(struct sprite *s, position p)
+static void batch_attrib(GLint loc, GLint size, size_t offset)
 {
-    ENSURE(shader);
+    glVertexAttribPointer(loc, size, GL_FLOAT, GL_FALSE, sizeof (struct batch_vertex),
+                          (const GLvoid *)offset);
+    glEnableVertexAttribArray(loc);
+}
 
-    glUseProgram(shader);
+void sprite_batch_begin(void)
+{
+    ENSURE(batch_shader && !batch.is_open);
+    batch.is_open = true;
+    batch.atlas = NULL;
+    batch.n = 0;
 
-    glBindBuffer(GL_ARRAY_BUFFER, a_vertices);
-    GLint vertices_atloc = glGetAttribLocation(shader, "a_vertex");
-    glVertexAttribPointer(vertices_atloc, 2, GL_FLOAT, GL_FALSE, 0, 0);
-    glEnableVertexAttribArray(vertices_atloc);
-    glEnableClientState(GL_VERTEX_ARRAY);
+    glUseProgram(batch_shader);
+    glUniformMatrix4fv(batch_loc.projection, 1, GL_FALSE, camera_projection_matrix);
+    glActiveTexture(GL_TEXTURE0);
+    glUniform1i(batch_loc.atlas, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, batch_vertices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch_indices);
+    batch_attrib(batch_loc.vertex, 2, offsetof(struct batch_vertex, vertex));
+    batch_attrib(batch_loc.translation, 2, offsetof(struct batch_vertex, translation));
+    batch_attrib(batch_loc.transform, 2, offsetof(struct batch_vertex, transform));
+    batch_attrib(batch_loc.clip, 2, offsetof(struct batch_vertex, clip));
+    batch_attrib(batch_loc.all_white, 1, offsetof(struct batch_vertex, all_white));
+}
+
+static void flush(void)
+{
+    if (0 == batch.n) return;
+    glBindTexture(GL_TEXTURE_2D, batch.atlas->id);
+    glUniform2f(batch_loc.atlas_size, batch.atlas->width, batch.atlas->height);
+    /* a fresh store each time, so we never wait on the last draw */
+    glBufferData(GL_ARRAY_BUFFER, 4 * batch.n * sizeof (*batch.vertices), batch.vertices,
+                 GL_STREAM_DRAW);
+    glDrawElements(GL_TRIANGLES, 6 * batch.n, GL_UNSIGNED_SHORT, 0);
+    batch.n = 0;
+}
 
+void sprite_batch_push(struct sprite *s, position p)
+{
+    ENSURE(batch.is_open);
+    if (s->atlas != batch.atlas || BATCH_MAX_SPRITES == batch.n) {
+        flush();
+        batch.atlas = s->atlas;
+    }
     p += world_camera.translation;
-    glUniform2f(glGetUniformLocation(shader, "u_translation"),
-                crealf(p) - s->w/2,
-                cimagf(p) - s->h/2);
-    glUniform1f(glGetUniformLocation(shader, "u_scaling"),
-                s->scaling);
-    glUniform1f(glGetUniformLocation(shader, "u_rotation"),
-                s->rotation);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "u_projection"),
-                       1, GL_FALSE, camera_projection_matrix);
+    struct batch_vertex v = {
+        .translation = { crealf(p) - s->w/2, cimagf(p) - s->h/2 },
+        .transform = { s->scaling, s->rotation },
+        .clip = { s->x, s->y },
+        .all_white = s->all_white
+    };
+    struct batch_vertex *q = &batch.vertices[4 * batch.n++];
+    q[0] = q[1] = q[2] = q[3] = v;
+    q[1].vertex[0] = q[2].vertex[0] = s->w;
+    q[2].vertex[1] = q[3].vertex[1] = s->h;
+}
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, s->atlas->id);
-    glUniform1i(glGetUniformLocation(shader, "u_atlas"), 0);
-    glUniform4f(glGetUniformLocation(shader, "u_clip"),
-                s->x, s->y, s->atlas->width, s->atlas->height);
-    glUniform1i(glGetUniformLocation(shader, "u_all_white"), s->all_white);
+void sprite_batch_end(void)
+{
+    ENSURE(batch.is_open);
+    flush();
+    batch.is_open = false;
+    /* The other programs draw from client memory, with fewer
+     * attributes. */
+    glDisableVertexAttribArray(batch_loc.translation);
+    glDisableVertexAttribArray(batch_loc.transform);
+    glDisableVertexAttribArray(batch_loc.clip);
+    glDisableVertexAttribArray(batch_loc.all_white);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
 
-    const GLfloat vertices[] = { 0., 0., s->w, 0., s->w, s->h, 0., s->h };
-    glBufferData(GL_ARRAY_BUFFER, sizeof (vertices), vertices, GL_DYNAMIC_DRAW);
+void sprite_draw(struct sprite *s, position p)
+{
+    sprite_batch_begin();
+    sprite_batch_push(s, p);
+    sprite_batch_end();
+}
 
-    uint8_t indices[] = { 0,1,2, 2,3,0 };
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, indices);
+void sprite_draw_batch(struct sprite *const *sprites, const position *ps, size_t n)
+{
+    sprite_batch_begin();
+    for (size_t i = 0; i < n; ++i)
+        sprite_batch_push(sprites[i], ps[i]);
+    sprite_batch_end();
 }
 
 #ifdef UNIT_TEST_SPRITE
@@ -91,13 +185,88 @@ static void test_basic_output(void)
     texture_destroy(sprite_a.atlas);
 }
 
+static void test_batch_output(void)
+{
+    note("Testing that batches draw exactly what sprite_draw does");
+    struct texture t;
+    struct sprite a = {.x = 0, .y = 0, .w = 16, .h = 16, .scaling = 1., .atlas = &t },
+        b = {.x = 16, .y = 0, .w = 16, .h = 16, .scaling = 1., .atlas = &t },
+        white_b = b;
+    white_b.all_white = true;
+    ok(texture_from_png(&t, "t/sprite.t-0.png"));
+    enum { N = 4 + 640 };
+    struct sprite *sprites[N];
+    position ps[N];
+    size_t n = 0;
+    position p = I*64;
+    sprites[n] = &a; ps[n++] = p;
+    sprites[n] = &a; ps[n++] = 32.+p;
+    sprites[n] = &b; ps[n++] = 64.+p;
+    sprites[n] = &white_b; ps[n++] = 96.+p;
+    p = I*128;
+    for (int i = 0; i < viewport_w && n < N; ++i) {
+        sprites[n] = (i%2) ? &a : &b;
+        ps[n++] = p+i;
+    }
+    video_start_frame();
+    sprite_draw_batch(sprites, ps, n);
+    video_end_frame();
+    ok(test_video_compare_fb_with_file("t/sprite.t-0.640x480.png"));
+    texture_destroy(&t);
+}
+
 int main(void)
 {
     video_init();
     camera_init();
     sprite_init();
-    plan(4);
+    plan(6);
     test_basic_output();
+    test_batch_output();
     done_testing();
 }
 #endif
+
+#ifdef PROFILE_SPRITE
+#include <stdio.h>
+#include <time.h>
+#include "video.h"
+#include "camera.h"
+
+/* Draws n_frames frames of n sprites scattered over the screen, one
+ * sprite_draw per sprite or all in one batch. */
+static double sprites_per_ms(bool is_batched)
+{
+    enum { N = 10000, N_FRAMES = 50 };
+    struct texture t;
+    ENSURE(texture_from_png(&t, "t/sprite.t-0.png"));
+    struct sprite s = {.x = 0, .y = 0, .w = 16, .h = 16, .scaling = 1., .atlas = &t };
+
+    clock_t start = clock();
+    for (int frame = 0; frame < N_FRAMES; ++frame) {
+        video_start_frame();
+        if (is_batched) sprite_batch_begin();
+        for (int i = 0; i < N; ++i) {
+            position p = (i * 7919) % viewport_w + I * ((i * 104729) % viewport_h);
+            if (is_batched) sprite_batch_push(&s, p);
+            else sprite_draw(&s, p);
+        }
+        if (is_batched) sprite_batch_end();
+        glFinish();
+        video_end_frame();
+    }
+    double elapsed = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    texture_destroy(&t);
+    return N * N_FRAMES / (1000. * elapsed);
+}
+
+int main(void)
+{
+    video_init();
+    camera_init();
+    sprite_init();
+    printf("sprite_draw: %.1f sprites per ms\n", sprites_per_ms(false));
+    printf("batched: %.1f sprites per ms\n", sprites_per_ms(true));
+}
+#endif
@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include "geometry.h"
 #include "texture.h"
@@ -14,4 +15,12 @@ struct sprite {
 };
 
 extern void sprite_init(void);
+/* Sprites pushed between begin and end are drawn in order, one draw
+ * call for each run of them sharing an atlas; nothing else may be
+ * drawn in between. */
+extern void sprite_batch_begin(void);
+extern void sprite_batch_push(struct sprite *s, position p);
+extern void sprite_batch_end(void);
+/* A batch of one, and a batch of n. */
 extern void sprite_draw(struct sprite *s, position p);
+extern void sprite_draw_batch(struct sprite *const *sprites, const position *ps, size_t n);
@@ -0,0 +1,29 @@
+attribute vec2 a_vertex, a_translation, a_transform, a_clip;
+attribute float a_all_white;
+uniform mat4 u_projection;
+uniform vec2 u_atlas_size;
+varying vec2 v_texcoord;
+varying float v_all_white;
+
+/* Every vertex carries its sprite's position, transform and clip, so a
+ * whole batch of sprites goes in one draw call. */
+void main()
+{
+    float scaling = a_transform.x, rotation = a_transform.y;
+    mat4 R = mat4(cos(rotation), -sin(rotation), 0.0, 0.0,
+                  sin(rotation), cos(rotation), 0.0, 0.0,
+                  0.0, 0.0, 1.0, 0.0,
+                  0.0, 0.0, 0.0, 1.0);
+    mat4 T = mat4(1.0, 0.0, 0.0, a_translation.x,
+                  0.0, 1.0, 0.0, a_translation.y,
+                  0.0, 0.0, 1.0, 0.0,
+                  0.0, 0.0, 0.0, 1.0);
+    mat4 S = mat4(scaling, 0.0, 0.0, 0.0,
+                  0.0, scaling, 0.0, 0.0,
+                  0.0, 0.0, 1.0, 0.0,
+                  0.0, 0.0, 0.0, 1.0);
+
+    gl_Position = u_projection * (vec4(a_vertex, 0., 1.) * R * T * S);
+    v_texcoord = (a_vertex + a_clip) / u_atlas_size;
+    v_all_white = a_all_white;
+}
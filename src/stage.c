@@ -51,3 +51,11 @@ void stage_update(float elapsed_time)
     for (int i = 0; i < n_layers; ++i)
         layer_update(layers[i], elapsed_time);
 }
+
+void stage_snapshot_regions(snapshot_region_fn fn)
+{
+    fn(layers, sizeof (layers));
+    fn(&n_layers, sizeof (n_layers));
+    for (int i = 0; i < n_layers; ++i)
+        layer_snapshot_regions(layers[i], fn);
+}
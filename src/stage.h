@@ -10,3 +10,5 @@ extern void stage_remove_layer(struct layer *);
 extern void stage_end(void);
 extern void stage_draw(void);
 extern void stage_update(float elapsed_time);
+/* The layers must stay the same between snapshots. */
+extern void stage_snapshot_regions(snapshot_region_fn fn);
@@ -1,6 +1,43 @@
-/* strand: green threads */
+/* strand: green threads
+ *
+ * On x86-64 and aarch64, we switch contexts ourselves, saving only
+ * the callee-saved registers and the stack pointer; swapcontext(3)
+ * also saves and restores the signal mask, which costs a system call
+ * on every switch.  Elsewhere, or if STRAND_USE_UCONTEXT is defined,
+ * we fall back on makecontext/swapcontext.
+ *
+ * Stacks are mapped with MAP_NORESERVE, so pages are only committed
+ * as they are touched, and sit above a PROT_NONE guard page so that
+ * an overflow faults instead of trampling whatever was allocated
+ * below.  Generous stack sizes therefore cost address space, not
+ * memory; strand_stack_high_water tells you how much was used.
+ *
+ * With STRAND_TELEMETRY, on by default in debug builds, every strand
+ * also keeps count of how often and for how long it runs, and the
+ * live strands can be enumerated with strand_foreach.
+ */
 
+#if defined(DEBUG) && !defined(STRAND_TELEMETRY)
+#define STRAND_TELEMETRY
+#endif
+
+#if !defined(STRAND_USE_UCONTEXT) && !defined(__x86_64__) && !defined(__aarch64__)
+#define STRAND_USE_UCONTEXT
+#endif
+
+#ifdef STRAND_USE_UCONTEXT
 #include <ucontext.h>
+#endif
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "ensure.h"
 #include "strand.h"
@@ -12,12 +49,125 @@
 #endif
 
 struct t {
+#ifdef STRAND_USE_UCONTEXT
     ucontext_t context;
     ucontext_t parent;
+    void *sp;                   /* at or below where it last yielded */
+#else
+    void *sp, *parent_sp;
+    void (*fn)(void);
+    void *arg;
+    bool takes_arg;
+#endif
+    void *stack;
+    size_t stack_size;
     float dt;
     bool is_alive;
+    /* scheduling; see scheduler_update */
+    struct scheduler *scheduler;
+    struct strand_link link, member;
+    enum { RUNNABLE, SLEEPING, WAITING } state;
+    uint64_t wake_tick;
+    double last_resumed;
+    bool (*predicate)(void *);
+    void *predicate_data;
+    bool is_parallel, is_migrating;
+    /* telemetry */
+    const char *name;
+#ifdef STRAND_TELEMETRY
+    struct strand_link all;
+    unsigned long n_resumes;
+    double total_seconds, max_seconds;
+#endif
 };
 
+static inline void list_init(struct strand_link *l) { l->next = l->prev = l; }
+static inline bool list_is_empty(struct strand_link *l) { return l->next == l; }
+
+static inline void list_remove(struct strand_link *l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    list_init(l);
+}
+
+static inline void list_append(struct strand_link *list, struct strand_link *l)
+{
+    l->prev = list->prev;
+    l->next = list;
+    list->prev->next = l;
+    list->prev = l;
+}
+
+/* Moves everything on from onto the (empty) list to. */
+static inline void list_splice(struct strand_link *from, struct strand_link *to)
+{
+    list_init(to);
+    if (list_is_empty(from)) return;
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to->prev->next = to;
+    list_init(from);
+}
+
+#ifdef STRAND_TELEMETRY
+/* Strands may be spawned and destroyed from worker threads, so the
+ * list of all of them needs a lock. */
+static struct strand_link all_strands = { &all_strands, &all_strands };
+static pthread_mutex_t all_strands_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define STRAND_OF_ALL(l) ((struct t *)((uint8_t *)(l) - offsetof(struct t, all)))
+#endif
+
+static void register_strand(struct t *st, const char *name)
+{
+    st->name = name;
+#ifdef STRAND_TELEMETRY
+    ENSURE_0(pthread_mutex_lock(&all_strands_lock));
+    list_append(&all_strands, &st->all);
+    ENSURE_0(pthread_mutex_unlock(&all_strands_lock));
+#endif
+}
+
+static void unregister_strand(struct t *st)
+{
+#ifdef STRAND_TELEMETRY
+    ENSURE_0(pthread_mutex_lock(&all_strands_lock));
+    list_remove(&st->all);
+    ENSURE_0(pthread_mutex_unlock(&all_strands_lock));
+#else
+    (void)st;
+#endif
+}
+
+static size_t page_size(void)
+{
+    static size_t size;
+    if (0 == size) ENSURE((size = sysconf(_SC_PAGESIZE)) > 0);
+    return size;
+}
+
+static void allocate_stack(struct t *st, size_t size_in_words)
+{
+    size_t page = page_size();
+    size_t size = (size_in_words * sizeof (void *) + page - 1) & ~(page - 1);
+    void *p = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ENSURE(MAP_FAILED != p);
+    ENSURE_0(mprotect(p, page, PROT_NONE));
+    st->stack = (uint8_t *)p + page;
+    st->stack_size = size;
+    (void)VALGRIND_STACK_REGISTER(st->stack, (uint8_t *)st->stack + size);
+}
+
+static void free_stack(struct t *st)
+{
+    size_t page = page_size();
+    ENSURE_0(munmap((uint8_t *)st->stack - page, st->stack_size + page));
+}
+
+#ifdef STRAND_USE_UCONTEXT
+
 static void strand_wrap_0(strand self, int (*fn)(strand))
 {
     (*fn)(self);
@@ -32,36 +182,231 @@ static void strand_wrap_1(strand self, int (*fn)(strand, void *), void *arg)
     st->is_alive = false;
 }
 
-static strand spawn(size_t size_in_words)
+static strand spawn(size_t size_in_words, const char *name)
 {
     struct t *st = calloc(1, sizeof (*st));
+    ENSURE(st);
     st->is_alive = true;
+    register_strand(st, name);
     getcontext(&st->parent);
     getcontext(&st->context);
     st->context.uc_link = &st->parent;
-    size_t size = size_in_words * sizeof (void *);
-    posix_memalign(&st->context.uc_stack.ss_sp, 16, size);
-    (void)VALGRIND_STACK_REGISTER(st->context.uc_stack.ss_sp, st->context.uc_stack.ss_sp + size);
-    st->context.uc_stack.ss_size = size;
+    allocate_stack(st, size_in_words);
+    st->context.uc_stack.ss_sp = st->stack;
+    st->context.uc_stack.ss_size = st->stack_size;
     return st;
 }
 
-strand strand_spawn_0(void (*fn)(strand), size_t size)
+strand strand_spawn_named_0(void (*fn)(strand), size_t size, const char *name)
 {
-    struct t *st = spawn(size);
+    struct t *st = spawn(size, name);
     makecontext(&st->context, (void(*)(void))strand_wrap_0, 2, st, fn);
     swapcontext(&st->parent, &st->context);  /* schedule strand once */
     return st;
 }
 
-strand strand_spawn_1(void (*fn)(strand, void *), size_t size, void *arg)
+strand strand_spawn_named_1(void (*fn)(strand, void *), size_t size, void *arg, const char *name)
 {
-    struct t *st = spawn(size);
+    struct t *st = spawn(size, name);
     makecontext(&st->context, (void(*)(void))strand_wrap_1, 3, st, fn, arg);
     swapcontext(&st->parent, &st->context);  /* schedule strand once */
     return st;
 }
 
+static inline void switch_to_strand(struct t *st)
+{
+    swapcontext(&st->parent, &st->context);
+}
+
+/* The saved stack pointer is buried in the context, so we settle
+ * for a frame just below our caller's. */
+static __attribute__((noinline)) void *below_caller(void)
+{
+    return __builtin_frame_address(0);
+}
+
+static inline void switch_to_parent(struct t *st)
+{
+    st->sp = below_caller();
+    swapcontext(&st->context, &st->parent);
+}
+
+#else  /* !STRAND_USE_UCONTEXT */
+
+/* switch_stacks(&from, to) pushes the callee-saved registers onto the
+ * current stack, stores the stack pointer in from, loads to, and pops
+ * the registers saved there.  A fresh stack is laid out by
+ * spawn() so that the first switch to it "returns" into
+ * strand_trampoline, with the strand in one callee-saved register and
+ * strand_entry in another. */
+extern void strand_switch_stacks(void **from, void *to) __attribute__((visibility("hidden")));
+extern void strand_trampoline(void) __attribute__((visibility("hidden")));
+
+#if defined(__x86_64__)
+__asm__(".pushsection .text\n"
+        ".globl strand_switch_stacks\n"
+        ".hidden strand_switch_stacks\n"
+        ".type strand_switch_stacks,@function\n"
+        "strand_switch_stacks:\n"
+        "\tpushq %rbp\n"
+        "\tpushq %rbx\n"
+        "\tpushq %r12\n"
+        "\tpushq %r13\n"
+        "\tpushq %r14\n"
+        "\tpushq %r15\n"
+        "\tmovq %rsp, (%rdi)\n"
+        "\tmovq %rsi, %rsp\n"
+        "\tpopq %r15\n"
+        "\tpopq %r14\n"
+        "\tpopq %r13\n"
+        "\tpopq %r12\n"
+        "\tpopq %rbx\n"
+        "\tpopq %rbp\n"
+        "\tret\n"
+        ".size strand_switch_stacks,.-strand_switch_stacks\n"
+        ".globl strand_trampoline\n"
+        ".hidden strand_trampoline\n"
+        ".type strand_trampoline,@function\n"
+        "strand_trampoline:\n"
+        "\tmovq %r12, %rdi\n"
+        "\tcallq *%r13\n"
+        "\tud2\n"
+        ".size strand_trampoline,.-strand_trampoline\n"
+        ".popsection\n");
+
+/* r15 r14 r13 r12 rbx rbp and the return address; an odd number of
+ * words, so that the ret into the trampoline leaves rsp at the
+ * (16-byte aligned) top of the stack, as the ABI wants at its call. */
+enum { INITIAL_FRAME_WORDS = 7, SELF_SLOT = 3, ENTRY_SLOT = 2, RETURN_SLOT = 6 };
+
+#elif defined(__aarch64__)
+__asm__(".pushsection .text\n"
+        ".globl strand_switch_stacks\n"
+        ".hidden strand_switch_stacks\n"
+        ".type strand_switch_stacks,%function\n"
+        "strand_switch_stacks:\n"
+        "\tsub sp, sp, #160\n"
+        "\tstp x19, x20, [sp, #0]\n"
+        "\tstp x21, x22, [sp, #16]\n"
+        "\tstp x23, x24, [sp, #32]\n"
+        "\tstp x25, x26, [sp, #48]\n"
+        "\tstp x27, x28, [sp, #64]\n"
+        "\tstp x29, x30, [sp, #80]\n"
+        "\tstp d8, d9, [sp, #96]\n"
+        "\tstp d10, d11, [sp, #112]\n"
+        "\tstp d12, d13, [sp, #128]\n"
+        "\tstp d14, d15, [sp, #144]\n"
+        "\tmov x2, sp\n"
+        "\tstr x2, [x0]\n"
+        "\tmov sp, x1\n"
+        "\tldp x19, x20, [sp, #0]\n"
+        "\tldp x21, x22, [sp, #16]\n"
+        "\tldp x23, x24, [sp, #32]\n"
+        "\tldp x25, x26, [sp, #48]\n"
+        "\tldp x27, x28, [sp, #64]\n"
+        "\tldp x29, x30, [sp, #80]\n"
+        "\tldp d8, d9, [sp, #96]\n"
+        "\tldp d10, d11, [sp, #112]\n"
+        "\tldp d12, d13, [sp, #128]\n"
+        "\tldp d14, d15, [sp, #144]\n"
+        "\tadd sp, sp, #160\n"
+        "\tret\n"
+        ".size strand_switch_stacks,.-strand_switch_stacks\n"
+        ".globl strand_trampoline\n"
+        ".hidden strand_trampoline\n"
+        ".type strand_trampoline,%function\n"
+        "strand_trampoline:\n"
+        "\tmov x0, x19\n"
+        "\tblr x20\n"
+        "\tbrk #0\n"
+        ".size strand_trampoline,.-strand_trampoline\n"
+        ".popsection\n");
+
+/* x19-x30 and d8-d15; x19 carries the strand, x20 the entry point,
+ * and x30 (the link register) the trampoline. */
+enum { INITIAL_FRAME_WORDS = 20, SELF_SLOT = 0, ENTRY_SLOT = 1, RETURN_SLOT = 11 };
+#endif
+
+static void strand_entry(struct t *st)
+{
+    if (st->takes_arg)
+        ((void (*)(strand, void *))st->fn)(st, st->arg);
+    else
+        ((void (*)(strand))st->fn)(st);
+    st->is_alive = false;
+    strand_switch_stacks(&st->sp, st->parent_sp);
+    ABORT("dead strand resumed");
+}
+
+static strand spawn(size_t size_in_words, void (*fn)(void), bool takes_arg, void *arg,
+                    const char *name)
+{
+    struct t *st = calloc(1, sizeof (*st));
+    ENSURE(st);
+    st->is_alive = true;
+    register_strand(st, name);
+    st->fn = fn;
+    st->takes_arg = takes_arg;
+    st->arg = arg;
+    allocate_stack(st, size_in_words);
+    uintptr_t *frame = (uintptr_t *)((uintptr_t)st->stack + st->stack_size) - INITIAL_FRAME_WORDS;
+    memset(frame, 0, INITIAL_FRAME_WORDS * sizeof (*frame));
+    frame[SELF_SLOT] = (uintptr_t)st;
+    frame[ENTRY_SLOT] = (uintptr_t)strand_entry;
+    frame[RETURN_SLOT] = (uintptr_t)strand_trampoline;
+    st->sp = frame;
+    return st;
+}
+
+static inline void switch_to_strand(struct t *st)
+{
+    strand_switch_stacks(&st->parent_sp, st->sp);
+}
+
+static inline void switch_to_parent(struct t *st)
+{
+    strand_switch_stacks(&st->sp, st->parent_sp);
+}
+
+strand strand_spawn_named_0(void (*fn)(strand), size_t size, const char *name)
+{
+    struct t *st = spawn(size, (void (*)(void))fn, false, NULL, name);
+    switch_to_strand(st);  /* schedule strand once */
+    return st;
+}
+
+strand strand_spawn_named_1(void (*fn)(strand, void *), size_t size, void *arg, const char *name)
+{
+    struct t *st = spawn(size, (void (*)(void))fn, true, arg, name);
+    switch_to_strand(st);  /* schedule strand once */
+    return st;
+}
+
+#endif  /* STRAND_USE_UCONTEXT */
+
+#ifdef STRAND_TELEMETRY
+static double monotonic_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+#endif
+
+/* Time spent in a strand includes any strands it resumes itself. */
+static void run(struct t *st)
+{
+#ifdef STRAND_TELEMETRY
+    double start = monotonic_now();
+    switch_to_strand(st);
+    double spent = monotonic_now() - start;
+    st->total_seconds += spent;
+    if (spent > st->max_seconds) st->max_seconds = spent;
+#else
+    switch_to_strand(st);
+#endif
+}
+
 void strand_resume(strand strand_, float dt)
 {
 #ifdef DEBUG
@@ -72,13 +417,16 @@ void strand_resume(strand strand_, float dt)
     struct t *st = strand_;
     if (!st->is_alive) return;
     st->dt = dt;
-    swapcontext(&st->parent, &st->context);
+#ifdef STRAND_TELEMETRY
+    ++st->n_resumes;
+#endif
+    run(st);
 }
 
 float strand_yield(strand self)
 {
     struct t *st = self;
-    swapcontext(&st->context, &st->parent);
+    switch_to_parent(st);
     return st->dt;
 }
 
@@ -87,15 +435,656 @@ bool strand_is_alive(strand st)
     return ((struct t *)st)->is_alive;
 }
 
+static void detach(struct t *st);
+
 void strand_destroy(strand strand_)
 {
     struct t *st = strand_;
-    free(st->context.uc_stack.ss_sp);
+    if (st->scheduler) detach(st);
+    unregister_strand(st);
+    free_stack(st);
     memset(st, 0, sizeof (*st));
     free(st);
 }
 
+/* The stack grows down, so the lowest page that has ever been touched
+ * marks the deepest the strand has gone.  mincore(2) tells us which
+ * pages are resident without us having to pre-fill the stack with a
+ * pattern, which would commit every page of it. */
+size_t strand_stack_high_water(strand strand_)
+{
+    struct t *st = strand_;
+    size_t page = page_size(), n_pages = st->stack_size / page;
+    unsigned char resident[n_pages];
+    ENSURE_0(mincore(st->stack, st->stack_size, resident));
+    size_t i;
+    for (i = 0; i < n_pages && !(resident[i] & 1); ++i);
+    return (n_pages - i) * page / sizeof (void *);
+}
+
+void strand_stats(strand strand_, struct strand_stats *stats)
+{
+    struct t *st = strand_;
+    *stats = (struct strand_stats){
+        .name = st->name,
+        .stack_high_water = strand_stack_high_water(st)
+    };
+#ifdef STRAND_TELEMETRY
+    stats->n_resumes = st->n_resumes;
+    stats->total_seconds = st->total_seconds;
+    stats->max_seconds = st->max_seconds;
+#endif
+}
+
+void strand_foreach(void (*fn)(strand, void *), void *data)
+{
+#ifdef STRAND_TELEMETRY
+    ENSURE_0(pthread_mutex_lock(&all_strands_lock));
+    for (struct strand_link *l = all_strands.next; l != &all_strands; l = l->next)
+        (*fn)(STRAND_OF_ALL(l), data);
+    ENSURE_0(pthread_mutex_unlock(&all_strands_lock));
+#else
+    (void)fn, (void)data;
+#endif
+}
+
+
+/* The scheduler owns the strands added to it until they die: each
+ * frame, it resumes the runnable ones and any whose sleep or wait
+ * has ended, and leaves the rest alone.  Sleepers live in a
+ * hierarchical timer wheel, per Varghese and Lauck, with millisecond
+ * ticks: the first level holds anything due in the next 64 ticks,
+ * and each level above it covers 64 times the span of the one below,
+ * so inserting and expiring are constant time and each frame only
+ * touches the slots for the ticks that have just passed. */
+
+enum {
+    TICKS_PER_SECOND = 1000,
+    WHEEL_BITS = 6, WHEEL_SIZE = 1<<WHEEL_BITS, WHEEL_MASK = WHEEL_SIZE-1,
+    WHEEL_LEVELS = 4
+};
+
+struct deque {
+    atomic_long top, bottom;
+    _Atomic(struct t *) *buffer;
+    long capacity;
+};
+
+struct workers {
+    unsigned n;                 /* including the main thread */
+    struct worker {
+        pthread_t thread;
+        struct workers *pool;
+        unsigned index;
+        struct deque deque;
+    } *each;
+    pthread_barrier_t start, finish;
+    struct t **batch;
+    size_t n_batch, batch_capacity;
+    atomic_size_t remaining;
+    bool quit;
+};
+
+struct scheduler {
+    struct strand_link members, runnable, waiting;
+    struct strand_link wheel[WHEEL_LEVELS][WHEEL_SIZE];
+    uint64_t tick;
+    double now;
+    size_t n_strands;
+    struct workers *workers;
+};
+
+#define STRAND_OF_LINK(l) ((struct t *)((uint8_t *)(l) - offsetof(struct t, link)))
+
+static void make_runnable(struct scheduler *s, struct t *st)
+{
+    st->state = RUNNABLE;
+    list_append(&s->runnable, &st->link);
+}
+
+static void wheel_insert(struct scheduler *s, struct t *st)
+{
+    if (st->wake_tick <= s->tick) {
+        make_runnable(s, st);
+        return;
+    }
+    uint64_t delta = st->wake_tick - s->tick, expires = st->wake_tick;
+    unsigned level = 0;
+    while (level < WHEEL_LEVELS-1 && delta >= (uint64_t)1 << ((level+1) * WHEEL_BITS))
+        ++level;
+    /* Beyond the top level's span, park it in the furthest slot; it
+     * will be reinserted when that slot comes around. */
+    if (delta >= (uint64_t)1 << (WHEEL_LEVELS * WHEEL_BITS))
+        expires = s->tick + ((uint64_t)1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+    st->state = SLEEPING;
+    list_append(&s->wheel[level][(expires >> (level * WHEEL_BITS)) & WHEEL_MASK], &st->link);
+}
+
+static void wheel_reinsert_slot(struct scheduler *s, struct strand_link *slot)
+{
+    struct strand_link pending;
+    list_splice(slot, &pending);
+    while (!list_is_empty(&pending)) {
+        struct t *st = STRAND_OF_LINK(pending.next);
+        list_remove(&st->link);
+        wheel_insert(s, st);
+    }
+}
+
+static void wheel_advance(struct scheduler *s, uint64_t target)
+{
+    while (s->tick < target) {
+        ++s->tick;
+        for (unsigned level = 1; level < WHEEL_LEVELS; ++level) {
+            if (s->tick & (((uint64_t)1 << (level * WHEEL_BITS)) - 1)) break;
+            wheel_reinsert_slot(s, &s->wheel[level][(s->tick >> (level * WHEEL_BITS)) & WHEEL_MASK]);
+        }
+        wheel_reinsert_slot(s, &s->wheel[0][s->tick & WHEEL_MASK]);
+    }
+}
+
+scheduler scheduler_new(void)
+{
+    struct scheduler *s;
+    ENSURE(s = calloc(1, sizeof (*s)));
+    list_init(&s->members);
+    list_init(&s->runnable);
+    list_init(&s->waiting);
+    for (unsigned i = 0; i < WHEEL_LEVELS; ++i)
+        for (unsigned j = 0; j < WHEEL_SIZE; ++j)
+            list_init(&s->wheel[i][j]);
+    return s;
+}
+
+/* Whatever list a strand is on, it's also on its scheduler's list of
+ * members, so we can find it even if it's blocked on some wait queue
+ * the scheduler knows nothing about. */
+static void detach(struct t *st)
+{
+    list_remove(&st->link);
+    list_remove(&st->member);
+    --st->scheduler->n_strands;
+    st->scheduler = NULL;
+}
+
+static void stop_workers(struct scheduler *s);
+
+void scheduler_destroy(scheduler s_)
+{
+    struct scheduler *s = s_;
+    if (s->workers) stop_workers(s);
+    while (!list_is_empty(&s->members))
+        detach((struct t *)((uint8_t *)s->members.next - offsetof(struct t, member)));
+    ENSURE(0 == s->n_strands);
+    free(s);
+}
+
+void scheduler_add(scheduler s_, strand strand_)
+{
+    struct scheduler *s = s_;
+    struct t *st = strand_;
+    ENSURE(NULL == st->scheduler);
+    if (!st->is_alive) return;
+    st->scheduler = s;
+    st->last_resumed = s->now;
+    ++s->n_strands;
+    list_append(&s->members, &st->member);
+    make_runnable(s, st);
+}
+
+size_t scheduler_count(scheduler s)
+{
+    return ((struct scheduler *)s)->n_strands;
+}
+
+void scheduler_snapshot_regions(scheduler s_, snapshot_region_fn fn)
+{
+    struct scheduler *s = s_;
+    fn(s, sizeof (*s));
+    for (struct strand_link *l = s->members.next; l != &s->members; l = l->next) {
+        struct t *st = (struct t *)((uint8_t *)l - offsetof(struct t, member));
+        /* not the telemetry, which links every strand there is */
+        fn(st, offsetof(struct t, name));
+        /* only the live part of the stack, leaving the rest unmapped */
+        uint8_t *top = (uint8_t *)st->stack + st->stack_size;
+        fn(st->sp, top - (uint8_t *)st->sp);
+    }
+}
+
+/* A strand only says what it's waiting for before it yields; the
+ * scheduler files it afterwards, always on the main thread. */
+static void requeue(struct scheduler *s, struct t *st)
+{
+    if (!st->is_alive) {
+        detach(st);
+        return;
+    }
+    switch (st->state) {
+    case RUNNABLE:
+        if (list_is_empty(&st->link))
+            list_append(&s->runnable, &st->link);
+        break;
+    case SLEEPING:
+        wheel_insert(s, st);
+        break;
+    case WAITING:
+        /* otherwise, it's already on a wait queue */
+        if (st->predicate)
+            list_append(&s->waiting, &st->link);
+        break;
+    default:
+        ENSURE(false);
+    }
+}
+
+static void batch_parallel(struct workers *w, struct t *st);
+static bool run_in_parallel(struct scheduler *s);
+
+void scheduler_update(scheduler s_, float dt)
+{
+    struct scheduler *s = s_;
+    s->now += dt;
+    wheel_advance(s, (uint64_t)(s->now * TICKS_PER_SECOND));
+
+    for (struct strand_link *l = s->waiting.next, *next; l != &s->waiting; l = next) {
+        next = l->next;
+        struct t *st = STRAND_OF_LINK(l);
+        if ((*st->predicate)(st->predicate_data)) {
+            st->predicate = NULL;
+            list_remove(l);
+            make_runnable(s, st);
+        }
+    }
+
+    /* Anything made runnable while we work through this frame's
+     * batch waits for the next frame. */
+    struct strand_link batch;
+    list_splice(&s->runnable, &batch);
+    while (!list_is_empty(&batch)) {
+        struct t *st = STRAND_OF_LINK(batch.next);
+        list_remove(&st->link);
+        float elapsed = s->now - st->last_resumed;
+        if (elapsed <= 0.f) {
+            list_append(&s->runnable, &st->link);
+            continue;
+        }
+        st->last_resumed = s->now;
+        if (st->is_parallel && s->workers) {
+            st->dt = elapsed;
+            batch_parallel(s->workers, st);
+            continue;
+        }
+        strand_resume(st, elapsed);
+        requeue(s, st);
+    }
+    if (NULL == s->workers || 0 == s->workers->n_batch) return;
+
+    struct workers *w = s->workers;
+    if (!run_in_parallel(s))
+        for (size_t i = 0; i < w->n_batch; ++i)
+            strand_resume(w->batch[i], w->batch[i]->dt);
+    /* Strands that needed the main thread stopped part way through
+     * their turn; finish it here. */
+    for (size_t i = 0; i < w->n_batch; ++i) {
+        struct t *st = w->batch[i];
+        if (st->is_migrating)
+            run(st);
+        requeue(s, st);
+    }
+    w->n_batch = 0;
+}
+
+float strand_sleep(strand self, float seconds)
+{
+    struct t *st = self;
+    struct scheduler *s = st->scheduler;
+    if (NULL == s) {
+        double accum = 0.;
+        while (accum < seconds)
+            accum += strand_yield(self);
+        return accum;
+    }
+    st->wake_tick = (uint64_t)ceil((s->now + seconds) * TICKS_PER_SECOND);
+    st->state = SLEEPING;
+    return strand_yield(self);
+}
+
+float strand_wait_until(strand self, bool (*predicate)(void *), void *data)
+{
+    struct t *st = self;
+    struct scheduler *s = st->scheduler;
+    if (NULL == s) {
+        double accum = 0.;
+        while (!(*predicate)(data))
+            accum += strand_yield(self);
+        return accum;
+    }
+    if ((*predicate)(data)) return 0.f;
+    st->predicate = predicate;
+    st->predicate_data = data;
+    st->state = WAITING;
+    return strand_yield(self);
+}
+
+/* Parallel strands: a scheduler with workers runs the strands marked
+ * parallel on a pool of threads, each with a Chase-Lev work-stealing
+ * deque (per Chase and Lev, "Dynamic Circular Work-Stealing Deque",
+ * with the memory orderings of Lê et al.).  The main thread takes a
+ * share of the batch too, after it has run the strands that must
+ * stay on it.  Anything touching GL, the message system, or a wait
+ * queue must first call strand_migrate_to_main. */
+
+static _Thread_local int worker_index = -1;
+
+/* Strands can change threads across a yield, so the compiler mustn't
+ * cache the address of this thread-local across one.  (Nor
+ * pthread_self, which glibc declares const.) */
+static bool __attribute__((noinline)) on_worker_thread(void)
+{
+    return worker_index > 0;
+}
+
+static void deque_reserve(struct deque *d, long capacity)
+{
+    if (capacity <= d->capacity) return;
+    long n = 16;
+    while (n < capacity) n <<= 1;
+    free(d->buffer);
+    ENSURE(d->buffer = calloc(n, sizeof (*d->buffer)));
+    d->capacity = n;
+    atomic_store(&d->top, 0);
+    atomic_store(&d->bottom, 0);
+}
+
+static void deque_push(struct deque *d, struct t *st)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed),
+         t = atomic_load_explicit(&d->top, memory_order_acquire);
+    ENSURE(b - t < d->capacity);
+    atomic_store_explicit(&d->buffer[b & (d->capacity-1)], st, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+}
+
+static struct t *deque_pop(struct deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    struct t *st = NULL;
+    if (t <= b) {
+        st = atomic_load_explicit(&d->buffer[b & (d->capacity-1)], memory_order_relaxed);
+        if (t == b) {
+            if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t+1,
+                                                         memory_order_seq_cst,
+                                                         memory_order_relaxed))
+                st = NULL;
+            atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+        }
+    } else
+        atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+    return st;
+}
+
+static struct t *deque_steal(struct deque *d)
+{
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) return NULL;
+    struct t *st = atomic_load_explicit(&d->buffer[t & (d->capacity-1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t+1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+    return st;
+}
+
+static void batch_parallel(struct workers *w, struct t *st)
+{
+    if (w->n_batch == w->batch_capacity) {
+        w->batch_capacity = w->batch_capacity ? 2*w->batch_capacity : 64;
+        ENSURE(w->batch = realloc(w->batch, w->batch_capacity * sizeof (*w->batch)));
+    }
+    w->batch[w->n_batch++] = st;
+}
+
+static void work(struct workers *w, unsigned me)
+{
+    struct deque *mine = &w->each[me].deque;
+    size_t lo = w->n_batch * me / w->n, hi = w->n_batch * (me+1) / w->n;
+    for (size_t i = lo; i < hi; ++i)
+        deque_push(mine, w->batch[i]);
+
+    unsigned victim = me;
+    while (atomic_load(&w->remaining) > 0) {
+        struct t *st = deque_pop(mine);
+        if (NULL == st) {
+            victim = (victim + 1) % w->n;
+            if (victim == me) {
+                sched_yield();
+                continue;
+            }
+            st = deque_steal(&w->each[victim].deque);
+            if (NULL == st) continue;
+        }
+        strand_resume(st, st->dt);
+        atomic_fetch_sub(&w->remaining, 1);
+    }
+}
+
+static void *worker_main(void *data)
+{
+    struct worker *me = data;
+    struct workers *w = me->pool;
+    worker_index = me->index;
+    while (true) {
+        pthread_barrier_wait(&w->start);
+        if (w->quit) break;
+        work(w, me->index);
+        pthread_barrier_wait(&w->finish);
+    }
+    return NULL;
+}
+
+/* Runs the whole batch across the pool, returning false if it has to
+ * be run serially instead. */
+static bool run_in_parallel(struct scheduler *s)
+{
+    struct workers *w = s->workers;
+    /* We're already inside a worker; don't try to nest pools. */
+    if (on_worker_thread()) return false;
+    for (unsigned i = 0; i < w->n; ++i)
+        deque_reserve(&w->each[i].deque, w->n_batch / w->n + 1);
+    atomic_store(&w->remaining, w->n_batch);
+    pthread_barrier_wait(&w->start);
+    work(w, 0);
+    pthread_barrier_wait(&w->finish);
+    return true;
+}
+
+void scheduler_start_workers(scheduler s_, unsigned n_threads)
+{
+    struct scheduler *s = s_;
+    ENSURE(NULL == s->workers);
+    if (0 == n_threads) {
+        long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 1 ? n_cpus - 1 : 0;
+    }
+    if (0 == n_threads) return;
+
+    struct workers *w;
+    ENSURE(w = calloc(1, sizeof (*w)));
+    w->n = n_threads + 1;
+    ENSURE(w->each = calloc(w->n, sizeof (*w->each)));
+    ENSURE_0(pthread_barrier_init(&w->start, NULL, w->n));
+    ENSURE_0(pthread_barrier_init(&w->finish, NULL, w->n));
+    s->workers = w;
+    for (unsigned i = 0; i < w->n; ++i) {
+        w->each[i].pool = w;
+        w->each[i].index = i;
+    }
+    for (unsigned i = 1; i < w->n; ++i)
+        ENSURE_0(pthread_create(&w->each[i].thread, NULL, worker_main, &w->each[i]));
+}
+
+static void stop_workers(struct scheduler *s)
+{
+    struct workers *w = s->workers;
+    w->quit = true;
+    pthread_barrier_wait(&w->start);
+    for (unsigned i = 1; i < w->n; ++i)
+        ENSURE_0(pthread_join(w->each[i].thread, NULL));
+    pthread_barrier_destroy(&w->start);
+    pthread_barrier_destroy(&w->finish);
+    for (unsigned i = 0; i < w->n; ++i)
+        free(w->each[i].deque.buffer);
+    free(w->each);
+    free(w->batch);
+    free(w);
+    s->workers = NULL;
+}
+
+void strand_set_parallel(strand strand_, bool is_parallel)
+{
+    ((struct t *)strand_)->is_parallel = is_parallel;
+}
+
+void strand_migrate_to_main(strand self)
+{
+    struct t *st = self;
+    if (!on_worker_thread()) return;
+    st->is_migrating = true;
+    switch_to_parent(st);
+    st->is_migrating = false;
+}
+
+/* Wait queues: a strand blocked on one is off its scheduler's lists
+ * entirely until whatever it waits for happens, at which point it
+ * becomes runnable again.  Strands outside any scheduler fall back on
+ * polling, as with strand_wait_until. */
+
+static void wait_queue_init(struct strand_link *queue)
+{
+    list_init(queue);
+}
+
+static float wait_on(struct t *st, struct strand_link *queue)
+{
+    ENSURE(st->scheduler);
+    strand_migrate_to_main(st);
+    st->state = WAITING;
+    list_append(queue, &st->link);
+    return strand_yield(st);
+}
+
+static void wake_all(struct strand_link *queue)
+{
+    while (!list_is_empty(queue)) {
+        struct t *st = STRAND_OF_LINK(queue->next);
+        list_remove(&st->link);
+        make_runnable(st->scheduler, st);
+    }
+}
+
+void strand_latch_init(struct strand_latch *latch, unsigned count)
+{
+    latch->count = count;
+    wait_queue_init(&latch->waiters);
+}
+
+bool strand_latch_count_down(struct strand_latch *latch)
+{
+    if (0 == latch->count) return false;
+    if (0 == --latch->count)
+        wake_all(&latch->waiters);
+    return true;
+}
+
+float strand_latch_wait(strand self, struct strand_latch *latch)
+{
+    if (0 == latch->count) return 0.f;
+    if (NULL == ((struct t *)self)->scheduler) {
+        double accum = 0.;
+        while (latch->count > 0)
+            accum += strand_yield(self);
+        return accum;
+    }
+    return wait_on(self, &latch->waiters);
+}
+
+void strand_event_init(struct strand_event *event)
+{
+    event->is_set = false;
+    wait_queue_init(&event->waiters);
+}
+
+void strand_event_set(struct strand_event *event)
+{
+    if (event->is_set) return;
+    event->is_set = true;
+    wake_all(&event->waiters);
+}
+
+float strand_event_wait(strand self, struct strand_event *event)
+{
+    if (event->is_set) return 0.f;
+    if (NULL == ((struct t *)self)->scheduler) {
+        double accum = 0.;
+        while (!event->is_set)
+            accum += strand_yield(self);
+        return accum;
+    }
+    return wait_on(self, &event->waiters);
+}
+
+void strand_signal_init(struct strand_signal *signal)
+{
+    signal->generation = 0;
+    wait_queue_init(&signal->waiters);
+}
+
+void strand_signal_raise(struct strand_signal *signal)
+{
+    ++signal->generation;
+    wake_all(&signal->waiters);
+}
+
+float strand_signal_wait(strand self, struct strand_signal *signal)
+{
+    if (NULL == ((struct t *)self)->scheduler) {
+        unsigned long generation = signal->generation;
+        double accum = 0.;
+        while (generation == signal->generation)
+            accum += strand_yield(self);
+        return accum;
+    }
+    return wait_on(self, &signal->waiters);
+}
+
+/* Stackless coroutines: see strand.h. */
+
+void coro_init(struct coro *c, void (*fn)(struct coro *))
+{
+    *c = (struct coro){ .fn = fn };
+}
+
+void coro_resume(struct coro *c, float dt)
+{
+    if (c->is_done) return;
+    c->dt = dt;
+    (*c->fn)(c);
+}
+
+bool coro_is_alive(struct coro *c)
+{
+    return !c->is_done;
+}
+
+
 #ifdef UNIT_TEST_STRAND
+#include <stdio.h>
 #include "libtap/tap.h"
 
 static void run_two_strands_to_completion(void)
@@ -186,6 +1175,29 @@ static void test_basic_usage(void)
     lives_ok({test_recursive_2();});
 }
 
+static void test_stack_alignment(void)
+{
+    note("Test that strands run on an ABI-aligned stack");
+    char buf[32] = "";
+    void fn(strand self, void *data) {
+        /* varargs doubles spill with aligned SSE stores */
+        double resumed_with = strand_yield(self);
+        snprintf(data, 32, "%.2f %.2f", 1.5, resumed_with);
+    }
+    strand s = strand_spawn_1(fn, STRAND_DEFAULT_STACK_SIZE, buf);
+    strand_resume(s, 2.25);
+    is(buf, "1.50 2.25", "Strands can pass doubles through varargs");
+    strand_destroy(s);
+
+    uintptr_t misalignment = 1;
+    void aligned_fn(strand _ __attribute__ ((unused))) {
+        _Alignas(16) volatile char local[16];
+        misalignment = (uintptr_t)local % 16;
+    }
+    strand_destroy(strand_spawn_0(aligned_fn, STRAND_DEFAULT_STACK_SIZE));
+    cmp_ok(misalignment, "==", 0, "Aligned locals are aligned");
+}
+
 static void test_too_small_stack(void)
 {
     note("Test stack overflow");
@@ -216,6 +1228,334 @@ static void test_too_small_stack(void)
     note("TODO: Is there a way to easily test stack underflow?");
 }
 
+static void test_stack_high_water(void)
+{
+    note("Test stack high-water measurement");
+    void fn(strand self, void *data) {
+        volatile char space[(intptr_t)data];
+        for (size_t i = 0; i < sizeof (space); i += 64) space[i] = 42;
+        strand_yield(self);
+    }
+    strand s = strand_spawn_1(fn, STRAND_DEFAULT_STACK_SIZE, (void *)64);
+    size_t shallow = strand_stack_high_water(s);
+    cmp_ok(shallow, "<", STRAND_DEFAULT_STACK_SIZE/8, "A shallow strand touches little of its stack");
+    strand_resume(s, 1.);
+    strand_destroy(s);
+
+    size_t deep_bytes = 4 * STRAND_DEFAULT_STACK_SIZE;
+    s = strand_spawn_1(fn, STRAND_DEFAULT_STACK_SIZE, (void *)deep_bytes);
+    size_t deep = strand_stack_high_water(s);
+    cmp_ok(deep, ">=", deep_bytes / sizeof (void *));
+    cmp_ok(deep, "<=", STRAND_DEFAULT_STACK_SIZE);
+    strand_resume(s, 1.);
+    strand_destroy(s);
+}
+
+static void test_telemetry(void)
+{
+    note("Test per-strand telemetry");
+    void busy(strand self) {
+        while (true) {
+            volatile double x = 0.;
+            for (int i = 0; i < 10000; ++i) x += sqrt(i);
+            strand_yield(self);
+        }
+    }
+    strand a = strand_spawn_0(busy, STRAND_DEFAULT_STACK_SIZE),
+        b = strand_spawn_named_0(busy, STRAND_DEFAULT_STACK_SIZE, "b");
+    for (int i = 0; i < 3; ++i)
+        strand_resume(a, 1.);
+    struct strand_stats stats;
+    strand_stats(a, &stats);
+    is(stats.name, "busy", "Strands are named after their function by default");
+    cmp_ok(stats.n_resumes, "==", 3);
+    ok(stats.total_seconds > 0. && stats.max_seconds <= stats.total_seconds);
+    ok(stats.stack_high_water > 0);
+
+    int n_a = 0, n_b = 0;
+    void count(strand st, void *data) {
+        (void)data;
+        n_a += st == a;
+        n_b += st == b;
+    }
+    strand_foreach(count, NULL);
+    ok(1 == n_a && 1 == n_b, "Live strands are enumerated");
+    strand_destroy(a);
+    n_a = n_b = 0;
+    strand_foreach(count, NULL);
+    ok(0 == n_a && 1 == n_b, "Destroyed strands are not");
+    strand_stats(b, &stats);
+    is(stats.name, "b");
+    strand_destroy(b);
+}
+
+static void test_scheduler_sleep(void)
+{
+    note("Test scheduled sleeps");
+    struct sleeper { float duration, woke_at, clock; int n_resumes; };
+    void fn(strand self, void *data) {
+        struct sleeper *me = data;
+        me->clock += strand_sleep(self, me->duration);
+        me->woke_at = me->clock;
+        ++me->n_resumes;
+    }
+    /* the last of these is beyond the span of the wheel */
+    struct sleeper sleepers[] = { {.duration = 0.5}, {.duration = 1.}, {.duration = 2.5},
+                                  {.duration = 90.}, {.duration = 5000.}, {.duration = 20000.} };
+    enum { N = sizeof (sleepers) / sizeof (*sleepers) };
+    strand s[N];
+    scheduler sched = scheduler_new();
+    for (int i = 0; i < N; ++i) {
+        s[i] = strand_spawn_1(fn, STRAND_DEFAULT_STACK_SIZE, &sleepers[i]);
+        scheduler_add(sched, s[i]);
+    }
+    const float dt = 1./60.;
+    double t = 0.;
+    for (int frame = 0; frame < 6000; ++frame, t += dt)
+        scheduler_update(sched, dt);
+    for (int frame = 0; scheduler_count(sched) > 0 && frame < 3000; ++frame, t += 10.)
+        scheduler_update(sched, 10.);
+    cmp_ok(scheduler_count(sched), "==", 0, "Every sleeper woke up");
+    bool all_on_time = true, all_resumed_once = true;
+    for (int i = 0; i < N; ++i) {
+        float slop = sleepers[i].duration < 100. ? dt : 10.;
+        if (sleepers[i].woke_at < sleepers[i].duration ||
+            sleepers[i].woke_at > sleepers[i].duration + 2*slop) {
+            diag("slept %f, woke at %f", sleepers[i].duration, sleepers[i].woke_at);
+            all_on_time = false;
+        }
+        all_resumed_once &= (1 == sleepers[i].n_resumes);
+        strand_destroy(s[i]);
+    }
+    ok(all_on_time, "Sleepers woke neither early nor late");
+    ok(all_resumed_once, "Sleepers weren't resumed until they were due");
+    scheduler_destroy(sched);
+}
+
+static void test_scheduler_wait_until(void)
+{
+    note("Test scheduled waits and yields");
+    int counter = 0, n_resumes = 0;
+    bool reached_ten(void *data) { return *(int *)data >= 10; }
+    void waiter(strand self) {
+        strand_wait_until(self, reached_ten, &counter);
+        ++n_resumes;
+    }
+    void counter_fn(strand self) {
+        while (true) {
+            ++counter;
+            strand_yield(self);
+        }
+    }
+    strand w = strand_spawn_0(waiter, STRAND_DEFAULT_STACK_SIZE),
+           c = strand_spawn_0(counter_fn, STRAND_DEFAULT_STACK_SIZE);
+    scheduler sched = scheduler_new();
+    scheduler_add(sched, w);
+    scheduler_add(sched, c);
+    for (int i = 0; i < 20; ++i)
+        scheduler_update(sched, 1./60.);
+    ok(!strand_is_alive(w));
+    cmp_ok(n_resumes, "==", 1);
+    cmp_ok(scheduler_count(sched), "==", 1);
+    strand_destroy(c);
+    cmp_ok(scheduler_count(sched), "==", 0, "Destroying a strand removes it from its scheduler");
+    strand_destroy(w);
+    scheduler_destroy(sched);
+
+    counter = 0;
+    w = strand_spawn_0(waiter, STRAND_DEFAULT_STACK_SIZE);
+    while (strand_is_alive(w)) {
+        ++counter;
+        strand_resume(w, 1.);
+    }
+    cmp_ok(counter, "==", 10, "Waiting outside a scheduler polls");
+    strand_destroy(w);
+}
+
+static void test_snapshots(void)
+{
+    note("Test restoring a scheduler from a snapshot");
+    int seen = -1;
+    void counter_fn(strand self) {
+        /* the count lives on the strand's stack */
+        for (int i = 0; ; ++i) {
+            seen = i;
+            strand_yield(self);
+        }
+    }
+    strand c = strand_spawn_0(counter_fn, STRAND_DEFAULT_STACK_SIZE);
+    scheduler sched = scheduler_new();
+    scheduler_add(sched, c);
+    for (int i = 0; i < 3; ++i)
+        scheduler_update(sched, 1.);
+    scheduler_snapshot_regions(sched, snapshot_track);
+    snapshot s = snapshot_take(NULL);
+    cmp_ok(strand_stack_high_water(c), "<", STRAND_DEFAULT_STACK_SIZE/8,
+           "Snapshots leave untouched stack alone");
+    int at_snapshot = seen;
+    for (int i = 0; i < 5; ++i)
+        scheduler_update(sched, 1.);
+    cmp_ok(seen, "==", at_snapshot + 5);
+    snapshot_restore(s);
+    scheduler_update(sched, 1.);
+    cmp_ok(seen, "==", at_snapshot + 1, "Strands carry on from where the snapshot was taken");
+    snapshot_destroy(s);
+    snapshot_untrack_all();
+    strand_destroy(c);
+    scheduler_destroy(sched);
+}
+
+static void test_wait_queues(void)
+{
+    note("Test latches, events, and signals");
+    struct strand_latch latch;
+    struct strand_event event;
+    struct strand_signal signal;
+    int n_latch = 0, n_event = 0, n_signal = 0;
+    void latch_waiter(strand self) { strand_latch_wait(self, &latch); ++n_latch; }
+    void event_waiter(strand self) { strand_event_wait(self, &event); ++n_event; }
+    void signal_waiter(strand self) {
+        while (true) {
+            strand_signal_wait(self, &signal);
+            ++n_signal;
+        }
+    }
+    strand_latch_init(&latch, 3);
+    strand_event_init(&event);
+    strand_signal_init(&signal);
+
+    scheduler sched = scheduler_new();
+    strand s[] = { strand_spawn_0(latch_waiter, STRAND_DEFAULT_STACK_SIZE),
+                   strand_spawn_0(latch_waiter, STRAND_DEFAULT_STACK_SIZE),
+                   strand_spawn_0(event_waiter, STRAND_DEFAULT_STACK_SIZE),
+                   strand_spawn_0(signal_waiter, STRAND_DEFAULT_STACK_SIZE) };
+    enum { N = sizeof (s) / sizeof (*s) };
+    for (int i = 0; i < N; ++i)
+        scheduler_add(sched, s[i]);
+    for (int i = 0; i < 10; ++i)
+        scheduler_update(sched, 1./60.);
+    ok(0 == n_latch && 0 == n_event && 0 == n_signal, "Nobody wakes without cause");
+
+    strand_latch_count_down(&latch);
+    strand_latch_count_down(&latch);
+    strand_signal_raise(&signal);
+    strand_signal_raise(&signal);
+    scheduler_update(sched, 1./60.);
+    cmp_ok(n_latch, "==", 0, "A latch stays shut until it reaches zero");
+    cmp_ok(n_signal, "==", 1, "Raising a signal twice before the waiter runs wakes it once");
+    ok(strand_latch_count_down(&latch));
+    ok(!strand_latch_count_down(&latch), "Counting down past zero is refused");
+    strand_event_set(&event);
+    for (int i = 0; i < 10; ++i)
+        scheduler_update(sched, 1./60.);
+    cmp_ok(n_latch, "==", 2);
+    cmp_ok(n_event, "==", 1);
+    cmp_ok(n_signal, "==", 1);
+    cmp_ok(scheduler_count(sched), "==", 1);
+    cmp_ok(strand_event_wait(s[2], &event), "==", 0, "Waiting on a set event returns at once");
+    scheduler_destroy(sched);
+    for (int i = 0; i < N; ++i)
+        strand_destroy(s[i]);
+}
+
+static void test_parallel_strands(void)
+{
+    note("Test parallel strands on worker threads");
+    enum { N = 64, ROUNDS = 20 };
+    atomic_int n_rounds = 0, n_off_main = 0, n_migrated_on_main = 0, n_slept = 0;
+    struct strand_latch latch;
+    strand_latch_init(&latch, 1);
+    void fn(strand self) {
+        for (int i = 0; i < ROUNDS; ++i) {
+            volatile double x = 0.;
+            for (int j = 0; j < 20000; ++j) x += sqrt(j);
+            if (on_worker_thread())
+                atomic_fetch_add(&n_off_main, 1);
+            atomic_fetch_add(&n_rounds, 1);
+            strand_yield(self);
+        }
+        strand_migrate_to_main(self);
+        if (!on_worker_thread())
+            atomic_fetch_add(&n_migrated_on_main, 1);
+        strand_sleep(self, 0.05);
+        atomic_fetch_add(&n_slept, 1);
+        strand_latch_wait(self, &latch);
+    }
+
+    scheduler sched = scheduler_new();
+    scheduler_start_workers(sched, 3);
+    strand s[N];
+    for (int i = 0; i < N; ++i) {
+        s[i] = strand_spawn_0(fn, STRAND_DEFAULT_STACK_SIZE);
+        strand_set_parallel(s[i], true);
+        scheduler_add(sched, s[i]);
+    }
+    for (int i = 0; i < ROUNDS; ++i)
+        scheduler_update(sched, 1./60.);
+    cmp_ok(n_rounds, "==", N*ROUNDS, "Every parallel strand runs once per update");
+    ok(n_off_main > 0, "Some strands ran on worker threads");
+    scheduler_update(sched, 1./60.);
+    cmp_ok(n_migrated_on_main, "==", N, "Migrated strands run on the main thread");
+    for (int i = 0; i < 10; ++i)
+        scheduler_update(sched, 1./60.);
+    cmp_ok(n_slept, "==", N, "Parallel strands can sleep");
+    cmp_ok(scheduler_count(sched), "==", N);
+    strand_latch_count_down(&latch);
+    scheduler_update(sched, 1./60.);
+    cmp_ok(scheduler_count(sched), "==", 0, "Parallel strands can wait on queues");
+    scheduler_destroy(sched);
+    for (int i = 0; i < N; ++i)
+        strand_destroy(s[i]);
+}
+
+static void test_coroutines(void)
+{
+    note("Test stackless coroutines");
+    enum { N = 10000 };
+    int n_woken = 0, n_done = 0;
+    bool go = false;
+    struct script { struct coro coro; int i; };
+    void fn(struct coro *c) {
+        struct script *s = (struct script *)c;
+        CORO_BEGIN(c);
+        for (s->i = 0; s->i < 3; ++s->i)
+            CORO_YIELD(c);
+        CORO_SLEEP(c, 0.5f);
+        ++n_woken;
+        CORO_WAIT_UNTIL(c, go);
+        ++n_done;
+        CORO_END(c);
+    }
+    ok(sizeof (struct script) <= 40, "Coroutines are small");
+    struct script *scripts = calloc(N, sizeof (*scripts));
+    for (int i = 0; i < N; ++i)
+        coro_init(&scripts[i].coro, fn);
+    /* dt is exact in binary, so the sleep ends on a known frame */
+    const float dt = 0.125f;
+    for (int frame = 0; frame < 4; ++frame)
+        for (int i = 0; i < N; ++i)
+            coro_resume(&scripts[i].coro, dt);
+    cmp_ok(scripts[N-1].i, "==", 3, "Locals survive yields");
+    for (int frame = 0; frame < 3; ++frame)
+        for (int i = 0; i < N; ++i)
+            coro_resume(&scripts[i].coro, dt);
+    cmp_ok(n_woken, "==", 0, "Sleeping coroutines sleep");
+    for (int i = 0; i < N; ++i)
+        coro_resume(&scripts[i].coro, dt);
+    cmp_ok(n_woken, "==", N);
+    for (int i = 0; i < N; ++i)
+        coro_resume(&scripts[i].coro, dt);
+    cmp_ok(n_done, "==", 0);
+    go = true;
+    for (int i = 0; i < N; ++i)
+        coro_resume(&scripts[i].coro, dt);
+    cmp_ok(n_done, "==", N);
+    ok(!coro_is_alive(&scripts[0].coro));
+    coro_resume(&scripts[0].coro, dt);
+    cmp_ok(n_done, "==", N, "Finished coroutines stay finished");
+    free(scripts);
+}
+
 static void test_nested_threads_1(int initial_count, int n_children)
 {
     void fn_a(strand self, void *data_) {
@@ -307,9 +1647,18 @@ int main(void)
     long seed = time(NULL);
     note("srand48(%ld)\n", seed);
     srand48(seed);
-    plan(40);
+    plan(87);
     test_basic_usage();
+    test_stack_alignment();
     test_too_small_stack();
+    test_stack_high_water();
+    test_telemetry();
+    test_scheduler_sleep();
+    test_scheduler_wait_until();
+    test_wait_queues();
+    test_parallel_strands();
+    test_coroutines();
+    test_snapshots();
     lives_ok({test_nested_threads_1(42, 4);});
     lives_ok({test_nested_threads_1(107, 12);});
     lives_ok({test_nested_threads_2(120);});
@@ -317,3 +1666,52 @@ int main(void)
     done_testing();
 }
 #endif
+
+
+#ifdef PROFILE_STRAND
+#include <stdio.h>
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void)
+{
+    const long n = 10*1000*1000;
+    void fn(strand self) {
+        while (true) strand_yield(self);
+    }
+    strand s = strand_spawn_0(fn, STRAND_DEFAULT_STACK_SIZE);
+    double start = now();
+    for (long i = 0; i < n; ++i)
+        strand_resume(s, 1.);
+    double elapsed = now() - start;
+    strand_destroy(s);
+#ifdef STRAND_USE_UCONTEXT
+    const char *how = "swapcontext";
+#else
+    const char *how = "assembly";
+#endif
+    printf("%s: %ld switches in %.3fs: %.0f switches/s\n", how, 2*n, elapsed, 2*n / elapsed);
+
+    enum { N_COROS = 10000 };
+    void coro_fn(struct coro *c) {
+        CORO_BEGIN(c);
+        while (true) CORO_YIELD(c);
+        CORO_END(c);
+    }
+    static struct coro coros[N_COROS];
+    for (int i = 0; i < N_COROS; ++i)
+        coro_init(&coros[i], coro_fn);
+    start = now();
+    for (long i = 0; i < n / N_COROS; ++i)
+        for (int j = 0; j < N_COROS; ++j)
+            coro_resume(&coros[j], 1.);
+    elapsed = now() - start;
+    printf("coroutines: %ld resumes in %.3fs: %.0f resumes/s\n", n, elapsed, n / elapsed);
+}
+#endif
@@ -3,12 +3,141 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "snapshot.h"
+
 enum { STRAND_DEFAULT_STACK_SIZE = 64*1024 };
 
 typedef void *strand;
-extern strand strand_spawn_0(void (*fn)(strand), size_t size_in_words);
-extern strand strand_spawn_1(void (*fn)(strand, void *), size_t size_in_words, void *argument);
+struct strand_link { struct strand_link *next, *prev; };  /* private */
+/* The name is kept for telemetry, so it must outlive the strand;
+ * the unnamed variants use the name of the function. */
+extern strand strand_spawn_named_0(void (*fn)(strand), size_t size_in_words, const char *name);
+extern strand strand_spawn_named_1(void (*fn)(strand, void *), size_t size_in_words, void *argument, const char *name);
+#define strand_spawn_0(fn, size) strand_spawn_named_0((fn), (size), #fn)
+#define strand_spawn_1(fn, size, arg) strand_spawn_named_1((fn), (size), (arg), #fn)
 extern void strand_resume(strand strand, float dt);
 extern float strand_yield(strand self);
 extern bool strand_is_alive(strand strand);
 extern void strand_destroy(strand strand);
+/* Approximate deepest stack usage so far, in words, to a page's
+ * granularity. */
+extern size_t strand_stack_high_water(strand strand);
+
+/* Without STRAND_TELEMETRY (see strand.c), only the name and stack
+ * high water are filled in, and strand_foreach visits nothing.  fn
+ * must not spawn or destroy strands. */
+struct strand_stats {
+    const char *name;
+    unsigned long n_resumes;
+    double total_seconds, max_seconds;  /* running, per resume */
+    size_t stack_high_water;            /* in words */
+};
+extern void strand_stats(strand strand, struct strand_stats *stats);
+extern void strand_foreach(void (*fn)(strand, void *), void *data);
+
+/* A scheduler resumes the strands added to it each time it is
+ * updated, except those sleeping or waiting, which cost nothing until
+ * they're due.  A strand may only belong to one scheduler; it leaves
+ * when it dies or is destroyed, but the scheduler never destroys
+ * strands itself. */
+typedef void *scheduler;
+extern scheduler scheduler_new(void);
+extern void scheduler_destroy(scheduler s);
+extern void scheduler_add(scheduler s, strand strand);
+extern void scheduler_update(scheduler s, float dt);
+extern size_t scheduler_count(scheduler s);
+/* The scheduler and its strands, and the live part of their stacks,
+ * as they are now; strands spawned later aren't covered, so track
+ * these afresh for each snapshot.  Only restore a snapshot between
+ * updates. */
+extern void scheduler_snapshot_regions(scheduler s, snapshot_region_fn fn);
+/* Runs strands marked parallel on n_threads worker threads (zero
+ * meaning one per spare core) as well as the calling thread, which
+ * must be the one that updates the scheduler.  Parallel strands may
+ * sleep and wait_until freely, but must call strand_migrate_to_main
+ * before touching anything shared with the main thread; they stay
+ * there until they next yield.  Waiting on a queue migrates
+ * implicitly. */
+extern void scheduler_start_workers(scheduler s, unsigned n_threads);
+extern void strand_set_parallel(strand strand, bool is_parallel);
+extern void strand_migrate_to_main(strand self);
+
+/* Both return the time elapsed since the strand last ran, like
+ * strand_yield.  A strand outside any scheduler can call them too,
+ * but then they simply yield until done. */
+extern float strand_sleep(strand self, float seconds);
+extern float strand_wait_until(strand self, bool (*predicate)(void *), void *data);
+
+/* Wait queues, for strands to block on until something happens
+ * rather than polling for it every frame.  Each must be initialized
+ * before use.  A latch opens when counted down to zero; an event
+ * stays set once set; a signal wakes only those waiting when it is
+ * raised.  The waits return like strand_yield, or 0 if no wait was
+ * necessary. */
+struct strand_latch {
+    unsigned count;
+    struct strand_link waiters;
+};
+extern void strand_latch_init(struct strand_latch *latch, unsigned count);
+/* false if the count was already zero */
+extern bool strand_latch_count_down(struct strand_latch *latch);
+extern float strand_latch_wait(strand self, struct strand_latch *latch);
+
+struct strand_event {
+    bool is_set;
+    struct strand_link waiters;
+};
+extern void strand_event_init(struct strand_event *event);
+extern void strand_event_set(struct strand_event *event);
+extern float strand_event_wait(strand self, struct strand_event *event);
+
+struct strand_signal {
+    unsigned long generation;
+    struct strand_link waiters;
+};
+extern void strand_signal_init(struct strand_signal *signal);
+extern void strand_signal_raise(struct strand_signal *signal);
+extern float strand_signal_wait(strand self, struct strand_signal *signal);
+
+/* Stackless coroutines, for behaviours too numerous to each have a
+ * strand's stack.  The body is a switch over the line it last
+ * yielded from, so it keeps nothing on the stack between resumes:
+ * embed a struct coro at the start of your own struct, keep every
+ * local that must survive a yield there, and cast back.  At most one
+ * yield (or CORO_SLEEP, or CORO_WAIT_UNTIL) per source line, and no
+ * yielding from inside a switch of your own.
+ *
+ *     struct blinker { struct coro coro; int n; };
+ *     void blink(struct coro *c) {
+ *         struct blinker *b = (struct blinker *)c;
+ *         CORO_BEGIN(c);
+ *         for (b->n = 0; b->n < 3; ++b->n) {
+ *             toggle();
+ *             CORO_SLEEP(c, 0.5f);
+ *         }
+ *         CORO_END(c);
+ *     }
+ *
+ * coro_resume drives it with dt, like strand_resume; the body sees
+ * it as c->dt. */
+struct coro {
+    void (*fn)(struct coro *);
+    unsigned line;
+    bool is_done;
+    float dt, timer;
+};
+extern void coro_init(struct coro *c, void (*fn)(struct coro *));
+extern void coro_resume(struct coro *c, float dt);
+extern bool coro_is_alive(struct coro *c);
+
+#define CORO_BEGIN(c) switch ((c)->line) { case 0:
+#define CORO_YIELD(c) do { (c)->line = __LINE__; return; case __LINE__:; } while (0)
+#define CORO_SLEEP(c, seconds) do {                     \
+        (c)->timer = (seconds);                         \
+        while ((c)->timer > 0.f) {                      \
+            CORO_YIELD(c);                              \
+            (c)->timer -= (c)->dt;                      \
+        }                                               \
+    } while (0)
+#define CORO_WAIT_UNTIL(c, condition) do { while (!(condition)) CORO_YIELD(c); } while (0)
+#define CORO_END(c) } (c)->is_done = true; return
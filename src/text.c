@@ -109,11 +109,12 @@ bool text_load_font(struct font *font, const char *path)
 
     strncpy(buf, path, BUFLEN);
     strncat(buf, ".png", BUFLEN-strlen(buf));
-    return texture_from_png(&font->texture, buf);
+    return NULL != (font->texture = texture_cache_acquire(buf));
 }
 
 void text_destroy_font(struct font *font)
 {
+    texture_cache_release(font->texture);
     free(font->glyphs);
     glDeleteBuffers(1, &a_vertices);
     memset(font, 0, sizeof (*font));
@@ -179,10 +180,10 @@ static void setup_shader(struct font *font, uint32_t color)
                 ((color>>8)&0xff)/255.,
                 (color&0xff)/255.);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, font->texture.id);
+    glBindTexture(GL_TEXTURE_2D, font->texture->id);
     glUniform1i(glGetUniformLocation(shader, "u_font"), 0);
     glUniform2f(glGetUniformLocation(shader, "u_font_dims"),
-                font->texture.width, font->texture.height);
+                font->texture->width, font->texture->height);
 }
 
 void text_render_line(struct font *font, position p, uint32_t color, const char *s)
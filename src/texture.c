@@ -1,5 +1,7 @@
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
 
 #include <pnglite.h>
 
@@ -101,6 +103,54 @@ void texture_destroy(struct texture *t)
     glDeleteTextures(1, &t->id);
 }
 
+/* We only ever have a handful of distinct textures, so a list will
+ * do. */
+struct cache_entry {
+    struct texture texture;
+    unsigned n_refs;
+    struct cache_entry *next;
+    char path[];
+};
+
+static struct cache_entry *cache;
+
+struct texture *texture_cache_acquire(const char *path)
+{
+    for (struct cache_entry *e = cache; e; e = e->next)
+        if (0 == strcmp(e->path, path)) {
+            ++e->n_refs;
+            return &e->texture;
+        }
+    size_t len = strlen(path) + 1;
+    struct cache_entry *e = malloc(sizeof (*e) + len);
+    ENSURE(e);
+    if (!texture_from_png(&e->texture, path)) {
+        free(e);
+        return NULL;
+    }
+    memcpy(e->path, path, len);
+    e->n_refs = 1;
+    e->next = cache;
+    cache = e;
+    return &e->texture;
+}
+
+void texture_cache_release(struct texture *t)
+{
+    if (NULL == t) return;
+    for (struct cache_entry **p = &cache; *p; p = &(*p)->next) {
+        struct cache_entry *e = *p;
+        if (&e->texture != t) continue;
+        ENSURE(e->n_refs > 0);
+        if (--e->n_refs) return;
+        texture_destroy(&e->texture);
+        *p = e->next;
+        free(e);
+        return;
+    }
+    ENSURE(false);  /* not from the cache */
+}
+
 #ifdef UNIT_TEST_TEXTURE
 #include "libtap/tap.h"
 #include "video.h"
@@ -135,15 +185,33 @@ static void test_png_loading(void)
     basic_check_texture("t/texture.t.from-png.npot.png", 65, 48);
 }
 
+static void test_texture_cache(void)
+{
+    note("Test the texture cache");
+    const char *path = "t/texture.t.from-png.rgba.png";
+    struct texture *a = texture_cache_acquire(path), *b = texture_cache_acquire(path);
+    ok(NULL != a && a == b, "Acquiring a path twice shares the texture");
+    GLuint id = a->id;
+    ok(glIsTexture(id));
+    texture_cache_release(a);
+    ok(glIsTexture(id), "It lives while references remain");
+    texture_cache_release(b);
+    ok(!glIsTexture(id), "The last release destroys it");
+    ok(NULL == texture_cache_acquire("t/texture.t.from-png.non-existent.png"));
+    a = texture_cache_acquire(path);
+    ok(NULL != a && 64 == a->width, "It can be loaded again");
+    texture_cache_release(a);
+}
+
 int main(void)
 {
     video_init();
     texture_init();
-    plan(20);
+    plan(25);
     test_png_loading();
+    test_texture_cache();
     todo();
     pass("test reading from raw data");
-    pass("test texture cache");
     pass("test destroying textures");
     end_todo;
     done_testing();
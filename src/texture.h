@@ -13,3 +13,9 @@ extern bool texture_from_pels(struct texture *t, uint8_t *pels,
                               uint16_t w, uint16_t h, uint8_t bpp);
 extern bool texture_from_png(struct texture *dest, const char *path);
 extern void texture_destroy(struct texture *t);
+
+/* Textures loaded from PNGs, shared by path and reference counted:
+ * the first acquire loads it, the last release destroys it.  NULL if
+ * it couldn't be loaded. */
+extern struct texture *texture_cache_acquire(const char *path);
+extern void texture_cache_release(struct texture *t);